@@ -3,7 +3,11 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* A block device. */
 struct block
@@ -19,8 +23,40 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request queue, served by a thread started on first use. */
+    struct semaphore queue_event;       /* Upped on submit and completion. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct list queue;                  /* Pending block_ios, oldest first. */
+    bool queue_started;                 /* Has the thread been started? */
+    block_sector_t head;                /* Sector after the last transfer. */
+    struct list free_transfers;         /* Transfers not in flight. */
+    struct block_stats stats;           /* I/O statistics. */
+
+    /* Transfers completed by the driver but not yet finished by
+       the queue thread.  Protected by disabling interrupts, since
+       drivers complete transfers from interrupt handlers. */
+    struct list done_transfers;
   };
 
+/* How long a request may be passed over by the elevator before
+   it is served ahead of everything else, in timer ticks.  Reads
+   usually have a thread waiting for them; writes seldom do. */
+#define READ_DEADLINE (TIMER_FREQ / 2)
+#define WRITE_DEADLINE (5 * TIMER_FREQ)
+
+/* Most segments a merged transfer may have. */
+#define MERGE_SEGS 64
+
+/* Most transfers kept in flight on a device whose driver has a
+   start operation.  Other devices have one at a time. */
+#define MAX_TRANSFERS 8
+
+/* Priority of the threads that serve request queues, above the
+   read-ahead work queue's, so that requests are passed to the
+   driver as soon as they arrive. */
+#define QUEUE_PRIORITY (PRI_DEFAULT + 2)
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -28,6 +64,9 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void submit_wait (struct block *, bool write,
+                         const struct block_request *);
+static thread_func queue_thread NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +159,11 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
+  struct block_segment seg = { buffer, 1 };
+  struct block_request req = { sector, &seg, 1 };
+
   check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  submit_wait (block, false, &req);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +174,389 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  struct block_segment seg = { (void *) buffer, 1 };
+  struct block_request req = { sector, &seg, 1 };
+
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  submit_wait (block, true, &req);
+}
+
+/* Returns the number of sectors transferred by REQ. */
+size_t
+block_request_size (const struct block_request *req)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < req->seg_cnt; i++)
+    cnt += req->segs[i].cnt;
+  return cnt;
+}
+
+/* Verifies that all of REQ's sectors are within BLOCK, and
+   returns how many there are.  Panics if not. */
+static size_t
+check_request (struct block *block, const struct block_request *req)
+{
+  size_t cnt = block_request_size (req);
+
+  if (cnt > 0)
+    {
+      check_sector (block, req->sector);
+      check_sector (block, req->sector + cnt - 1);
+      if (req->sector + cnt - 1 < req->sector)
+        PANIC ("Access past end of device %s (sector=%"PRDSNu", "
+               "count=%zu)\n", block_name (block), req->sector, cnt);
+    }
+  return cnt;
+}
+
+/* Reads the consecutive sectors described by REQ from BLOCK into
+   REQ's segments, with a single command where the driver can
+   do that.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, const struct block_request *req)
+{
+  if (check_request (block, req) > 0)
+    submit_wait (block, false, req);
+}
+
+/* Writes the consecutive sectors described by REQ to BLOCK from
+   REQ's segments, with a single command where the driver can do
+   that.  Returns after the block device has acknowledged
+   receiving all of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, const struct block_request *req)
+{
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (check_request (block, req) > 0)
+    submit_wait (block, true, req);
+}
+
+/* Initializes IO as a request to read, or write if WRITE is
+   true, the sectors starting at SECTOR to or from the SEG_CNT
+   segments in SEGS, calling DONE with AUX when it completes. */
+void
+block_io_init (struct block_io *io, bool write,
+               block_sector_t sector, const struct block_segment *segs,
+               size_t seg_cnt, block_io_func *done, void *aux)
+{
+  io->write = write;
+  io->req.sector = sector;
+  io->req.segs = segs;
+  io->req.seg_cnt = seg_cnt;
+  io->deadline = 0;
+  io->done = done;
+  io->aux = aux;
+}
+
+/* Queues IO on BLOCK and returns without waiting for it.
+   IO's callback runs once the transfer is complete. */
+void
+block_submit (struct block *block, struct block_io *io)
+{
+  size_t cnt = check_request (block, &io->req);
+
+  ASSERT (!io->write || block->type != BLOCK_FOREIGN);
+  if (cnt == 0)
+    {
+      io->done (io, io->aux);
+      return;
+    }
+  io->deadline = timer_ticks () + (io->write ? WRITE_DEADLINE
+                                             : READ_DEADLINE);
+  io->submit_ns = timer_ns ();
+
+  lock_acquire (&block->queue_lock);
+  if (!block->queue_started)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "%.12s-io", block->name);
+      if (thread_create (name, QUEUE_PRIORITY, queue_thread, block)
+          == TID_ERROR)
+        PANIC ("%s: cannot start request queue", block->name);
+      block->queue_started = true;
+    }
+  list_push_back (&block->queue, &io->elem);
+  lock_release (&block->queue_lock);
+  sema_up (&block->queue_event);
+}
+
+/* block_io callback that wakes up the semaphore in AUX. */
+static void
+wake_waiter (struct block_io *io UNUSED, void *aux)
+{
+  sema_up (aux);
+}
+
+/* Submits a request to BLOCK for REQ, reading or, if WRITE is
+   true, writing, and waits for it to complete. */
+static void
+submit_wait (struct block *block, bool write,
+             const struct block_request *req)
+{
+  struct semaphore done;
+  struct block_io io;
+
+  sema_init (&done, 0);
+  block_io_init (&io, write, req->sector, req->segs, req->seg_cnt,
+                 wake_waiter, &done);
+  block_submit (block, &io);
+  sema_down (&done);
+}
+
+/* Carries out REQ on BLOCK through its driver, reading or, if
+   WRITE is true, writing. */
+static void
+perform (struct block *block, bool write, const struct block_request *req)
+{
+  if (write ? block->ops->write_multi != NULL
+            : block->ops->read_multi != NULL)
+    (write ? block->ops->write_multi : block->ops->read_multi)
+      (block->aux, req);
+  else
+    {
+      block_sector_t sector = req->sector;
+      size_t i, j;
+
+      for (i = 0; i < req->seg_cnt; i++)
+        for (j = 0; j < req->segs[i].cnt; j++)
+          {
+            uint8_t *buffer = ((uint8_t *) req->segs[i].buffer
+                               + j * BLOCK_SECTOR_SIZE);
+            if (write)
+              block->ops->write (block->aux, sector++, buffer);
+            else
+              block->ops->read (block->aux, sector++, buffer);
+          }
+    }
+}
+
+/* Chooses the request in BLOCK's queue to serve next.  A request
+   that has waited past its deadline goes first.  Otherwise the
+   C-LOOK elevator takes the request with the lowest sector at or
+   beyond the head, wrapping around to the lowest sector of all
+   when there is none, so that the head sweeps the disk in one
+   direction.  The queue lock must be held and the queue must not
+   be empty. */
+static struct block_io *
+pick_next (struct block *block)
+{
+  struct block_io *oldest, *next = NULL, *lowest = NULL;
+  struct list_elem *e;
+
+  oldest = list_entry (list_front (&block->queue), struct block_io, elem);
+  if (timer_ticks () >= oldest->deadline)
+    return oldest;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_io *io = list_entry (e, struct block_io, elem);
+      block_sector_t sector = io->req.sector;
+
+      if (lowest == NULL || sector < lowest->req.sector)
+        lowest = io;
+      if (sector >= block->head
+          && (next == NULL || sector < next->req.sector))
+        next = io;
+    }
+  return next != NULL ? next : lowest;
+}
+
+/* Removes FIRST from BLOCK's queue, along with the queued
+   requests in the same direction that continue it on disk, and
+   moves them all to transfer T's list, setting up T's request to
+   cover the whole range.  The queue lock must be held. */
+static void
+take_merged (struct block *block, struct block_io *first,
+             struct block_transfer *t)
+{
+  block_sector_t end;
+  size_t seg_cnt;
+  bool merged;
+
+  list_remove (&first->elem);
+  list_push_back (&t->ios, &first->elem);
+  t->write = first->write;
+  t->req = first->req;
+  if (t->segs == NULL || first->req.seg_cnt > MERGE_SEGS)
+    return;
+
+  end = first->req.sector + block_request_size (&first->req);
+  seg_cnt = first->req.seg_cnt;
+  memcpy (t->segs, first->req.segs, seg_cnt * sizeof *t->segs);
+  do
+    {
+      struct list_elem *e;
+
+      merged = false;
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        {
+          struct block_io *io = list_entry (e, struct block_io, elem);
+          if (io->write == first->write && io->req.sector == end
+              && seg_cnt + io->req.seg_cnt <= MERGE_SEGS)
+            {
+              memcpy (t->segs + seg_cnt, io->req.segs,
+                      io->req.seg_cnt * sizeof *t->segs);
+              seg_cnt += io->req.seg_cnt;
+              end += block_request_size (&io->req);
+              list_remove (&io->elem);
+              list_push_back (&t->ios, &io->elem);
+              merged = true;
+              break;
+            }
+        }
+    }
+  while (merged);
+
+  if (list_size (&t->ios) > 1)
+    {
+      t->req.segs = t->segs;
+      t->req.seg_cnt = seg_cnt;
+    }
+}
+
+/* Returns the latency histogram bucket for a request that took
+   NS nanoseconds. */
+static int
+latency_bucket (int64_t ns)
+{
+  int64_t us = ns / 1000;
+  int bucket = 0;
+
+  while (us >= 2 && bucket < BLOCK_LATENCY_BUCKETS - 1)
+    {
+      us /= 2;
+      bucket++;
+    }
+  return bucket;
+}
+
+/* Adds the requests carried out by transfer T, which completed
+   at DONE_NS, to BLOCK's statistics.  The queue lock must be
+   held. */
+static void
+account (struct block *block, struct block_transfer *t, int64_t done_ns)
+{
+  struct block_dir_stats *st = (t->write ? &block->stats.write
+                                         : &block->stats.read);
+  struct list_elem *e;
+
+  st->transfers++;
+  if (t->sequential)
+    st->sequential++;
+  for (e = list_begin (&t->ios); e != list_end (&t->ios); e = list_next (e))
+    {
+      struct block_io *io = list_entry (e, struct block_io, elem);
+
+      st->requests++;
+      st->bytes += block_request_size (&io->req) * BLOCK_SECTOR_SIZE;
+      st->wait_ns += t->dispatch_ns - io->submit_ns;
+      st->latency_ns += done_ns - io->submit_ns;
+      st->latency[latency_bucket (done_ns - io->submit_ns)]++;
+    }
+}
+
+/* Called by a driver when transfer T, which it was given by its
+   start operation, has completed.  May be called from an
+   interrupt handler. */
+void
+block_transfer_done (struct block_transfer *t)
+{
+  enum intr_level old_level = intr_disable ();
+  list_push_back (&t->block->done_transfers, &t->elem);
+  intr_set_level (old_level);
+  sema_up (&t->block->queue_event);
+}
+
+/* Accounts for completed transfer T, runs the callbacks of its
+   block_ios, and returns it to BLOCK's free list. */
+static void
+finish_transfer (struct block *block, struct block_transfer *t)
+{
+  int64_t done_ns = timer_ns ();
+  size_t cnt = block_request_size (&t->req);
+
+  lock_acquire (&block->queue_lock);
+  if (t->write)
+    block->write_cnt += cnt;
+  else
+    block->read_cnt += cnt;
+  account (block, t, done_ns);
+  lock_release (&block->queue_lock);
+
+  while (!list_empty (&t->ios))
+    {
+      struct block_io *io = list_entry (list_pop_front (&t->ios),
+                                        struct block_io, elem);
+      io->done (io, io->aux);
+    }
+
+  lock_acquire (&block->queue_lock);
+  list_push_back (&block->free_transfers, &t->elem);
+  lock_release (&block->queue_lock);
+}
+
+/* Serves the request queue of the block device AUX forever.
+   Each time something happens, finishes the transfers that the
+   driver has completed, then starts queued requests for as long
+   as there are transfers free. */
+static void
+queue_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      sema_down (&block->queue_event);
+
+      for (;;)
+        {
+          struct block_transfer *t = NULL;
+          enum intr_level old_level = intr_disable ();
+          if (!list_empty (&block->done_transfers))
+            t = list_entry (list_pop_front (&block->done_transfers),
+                            struct block_transfer, elem);
+          intr_set_level (old_level);
+          if (t == NULL)
+            break;
+          finish_transfer (block, t);
+        }
+
+      lock_acquire (&block->queue_lock);
+      while (!list_empty (&block->queue)
+             && !list_empty (&block->free_transfers))
+        {
+          struct block_transfer *t
+            = list_entry (list_pop_front (&block->free_transfers),
+                          struct block_transfer, elem);
+
+          take_merged (block, pick_next (block), t);
+          t->sequential = t->req.sector == block->head;
+          block->head = t->req.sector + block_request_size (&t->req);
+          lock_release (&block->queue_lock);
+
+          t->dispatch_ns = timer_ns ();
+          if (block->ops->start != NULL)
+            block->ops->start (block->aux, t);
+          else
+            {
+              perform (block, t->write, &t->req);
+              finish_transfer (block, t);
+            }
+
+          lock_acquire (&block->queue_lock);
+        }
+      lock_release (&block->queue_lock);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,24 +580,62 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Prints the statistics in ST for requests in direction DIR. */
+static void
+print_dir_stats (const char *dir, const struct block_dir_stats *st)
+{
+  int i;
+
+  if (st->requests == 0)
+    return;
+  printf ("  %s: %llu requests in %llu transfers (%llu%% sequential), "
+          "%llu bytes\n",
+          dir, st->requests, st->transfers,
+          st->sequential * 100 / st->transfers, st->bytes);
+  printf ("  %s: average queue wait %llu us, latency %llu us\n", dir,
+          st->wait_ns / st->requests / 1000,
+          st->latency_ns / st->requests / 1000);
+  printf ("  %s latency (us):", dir);
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    if (st->latency[i] != 0)
+      printf (" %s%d:%"PRIu32, i < BLOCK_LATENCY_BUCKETS - 1 ? "<" : ">=",
+              i < BLOCK_LATENCY_BUCKETS - 1 ? 2 << i : 1 << i,
+              st->latency[i]);
+  printf ("\n");
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
 {
   int i;
 
-  for (i = 0; i < BLOCK_CNT; i++)
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
+          struct block_stats stats;
+
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          block_get_stats (block, &stats);
+          print_dir_stats ("reads", &stats.read);
+          print_dir_stats ("writes", &stats.write);
         }
     }
 }
 
+/* Copies BLOCK's I/O statistics into *STATS. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  lock_acquire (&block->queue_lock);
+  *stats = block->stats;
+  lock_release (&block->queue_lock);
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -189,6 +647,9 @@ block_register (const char *name, enum block_type type,
                 const struct block_operations *ops, void *aux)
 {
   struct block *block = malloc (sizeof *block);
+  struct block_transfer *transfers;
+  size_t transfer_cnt, i;
+
   if (block == NULL)
     PANIC ("Failed to allocate memory for block device descriptor");
 
@@ -200,6 +661,30 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  sema_init (&block->queue_event, 0);
+  lock_init (&block->queue_lock);
+  list_init (&block->queue);
+  block->queue_started = false;
+  block->head = 0;
+  list_init (&block->free_transfers);
+  list_init (&block->done_transfers);
+  transfer_cnt = ops->start != NULL ? MAX_TRANSFERS : 1;
+  transfers = malloc (transfer_cnt * sizeof *transfers);
+  if (transfers == NULL)
+    PANIC ("Failed to allocate memory for block device transfers");
+  for (i = 0; i < transfer_cnt; i++)
+    {
+      struct block_transfer *t = &transfers[i];
+
+      t->block = block;
+      list_init (&t->ios);
+      t->segs = malloc (MERGE_SEGS * sizeof *t->segs);
+      list_push_back (&block->free_transfers, &t->elem);
+    }
+  memset (&block->stats, 0, sizeof block->stats);
+  strlcpy (block->stats.name, block->name, sizeof block->stats.name);
+  strlcpy (block->stats.type, block_type_name (type),
+           sizeof block->stats.type);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
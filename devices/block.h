@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <block-stats.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -49,15 +52,81 @@ struct block *block_get_by_name (const char *name);
 struct block *block_first (void);
 struct block *block_next (struct block *);
 
+/* A piece of memory taking part in a multi-sector transfer. */
+struct block_segment
+  {
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    size_t cnt;                 /* Number of sectors. */
+  };
+
+/* A transfer of consecutive sectors, starting at SECTOR, to or
+   from the SEG_CNT pieces of memory in SEGS, in order. */
+struct block_request
+  {
+    block_sector_t sector;              /* First sector. */
+    const struct block_segment *segs;   /* Memory to transfer. */
+    size_t seg_cnt;                     /* Number of segments. */
+  };
+
 /* Block device operations. */
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, const struct block_request *);
+void block_write_multi (struct block *, const struct block_request *);
+size_t block_request_size (const struct block_request *);
+
+/* Asynchronous block I/O.
+
+   A struct block_io is handed to block_submit(), which queues it
+   on the device and returns at once.  Each device serves its
+   queue from its own thread, in elevator order, merging requests
+   for adjacent sectors into one transfer, and calls DONE with
+   AUX in that thread when the transfer is complete.  The
+   block_io and the memory it names must stay valid until then. */
+struct block_io;
+typedef void block_io_func (struct block_io *, void *aux);
+
+struct block_io
+  {
+    struct list_elem elem;              /* Element in device queue. */
+    bool write;                         /* Write or read? */
+    struct block_request req;           /* Sectors and memory. */
+    int64_t deadline;                   /* Timer tick to serve it by. */
+    int64_t submit_ns;                  /* When it was submitted. */
+    block_io_func *done;                /* Completion callback. */
+    void *aux;                          /* Passed to DONE. */
+  };
+
+void block_io_init (struct block_io *, bool write,
+                    block_sector_t sector, const struct block_segment *,
+                    size_t seg_cnt, block_io_func *done, void *aux);
+void block_submit (struct block *, struct block_io *);
+
+/* A transfer that the request queue hands to a driver: one or
+   more block_ios, merged into a single request. */
+struct block_transfer
+  {
+    bool write;                         /* Write or read? */
+    struct block_request req;           /* Sectors and memory. */
+    struct block_io io;                 /* For drivers that pass the
+                                           transfer to another device. */
+    int parts;                          /* For drivers that split it. */
+
+    /* Owned by the block layer. */
+    struct block *block;                /* Device. */
+    struct list_elem elem;              /* Free or completed list elem. */
+    struct list ios;                    /* block_ios it carries out. */
+    struct block_segment *segs;         /* Segments of merged requests. */
+    bool sequential;                    /* Began at the previous end? */
+    int64_t dispatch_ns;                /* When it was started. */
+  };
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
 void block_print_stats (void);
+void block_get_stats (struct block *, struct block_stats *);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,8 +134,21 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  If null, multi-sector requests are carried out
+       one sector at a time with read or write. */
+    void (*read_multi) (void *aux, const struct block_request *);
+    void (*write_multi) (void *aux, const struct block_request *);
+
+    /* Optional.  If non-null, the request queue passes transfers
+       to START instead of the functions above, and keeps several
+       of them in flight at once.  START may sleep.  The driver
+       calls block_transfer_done() when the transfer completes,
+       possibly from an interrupt handler. */
+    void (*start) (void *aux, struct block_transfer *);
   };
 
+void block_transfer_done (struct block_transfer *);
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
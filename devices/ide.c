@@ -1,17 +1,31 @@
 #include "devices/ide.h"
 #include <ctype.h>
 #include <debug.h>
+#include <round.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Transfers use bus-master DMA when the controller is a PCI IDE
+   controller that supports it, such as the PIIX that QEMU
+   emulates, and the disk does too.  The controller then copies
+   the data to or from memory by itself, described by a table of
+   physical region descriptors (PRDs), and interrupts once when
+   the whole transfer is done.  Otherwise, and for buffers DMA
+   cannot reach, the CPU copies each sector through the data
+   register in PIO mode. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +44,24 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE register port addresses. */
+#define bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)    /* Command. */
+#define bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)     /* Status. */
+#define bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)       /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer into memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERROR 0x02       /* Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt raised (write 1 to clear). */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +77,12 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors that one READ or WRITE SECTOR command can
+   transfer.  A sector count of 0 asks for this many. */
+#define MAX_MULTI_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,8 +91,25 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool dma;                   /* Use DMA for transfers? */
+  };
+
+/* A physical region descriptor: one piece of memory in a DMA
+   transfer.  It may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, even. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
   };
 
+#define PRD_EOT 0x8000                          /* End of table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))  /* Entries per table. */
+
+/* Longest a DMA transfer may take, in milliseconds, before the
+   disk is assumed to be stuck. */
+#define DMA_TIMEOUT_MS 5000
+
 /* An ATA channel (aka controller).
    Each channel can control up to two disks. */
 struct channel
@@ -66,12 +117,20 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master base port, 0 if no DMA. */
+    struct prd *prdt;           /* PRD table, one page. */
 
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    /* DMA watchdog, see wait_for_dma(). */
+    struct work dma_timeout;    /* Fires DMA_TIMEOUT_MS after a start. */
+    bool dma_waiting;           /* True while a DMA transfer is running. */
+    int64_t dma_deadline;       /* Tick at which it times out. */
+    bool dma_timed_out;         /* Set by the watchdog. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,7 +144,20 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static uint16_t find_bus_master (void);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
+static void transfer (struct ata_disk *, const struct block_request *,
+                      bool write);
+static void *next_buffer (const struct block_request *,
+                          size_t *seg, size_t *ofs);
+static void pio_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          const struct block_request *,
+                          size_t *seg, size_t *ofs, bool write);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          const struct block_request *,
+                          size_t *seg, size_t *ofs, bool write);
+static bool wait_for_dma (struct channel *);
+static work_func dma_timeout;
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -101,6 +173,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +199,18 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      work_init (&c->dma_timeout, dma_timeout, c);
+      c->dma_waiting = false;
+
+      /* Each channel has its own set of bus master registers. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +221,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -155,6 +241,30 @@ ide_init (void)
     }
 }
 
+/* Returns true if D is an IDE controller. */
+static bool
+is_ide_controller (const struct pci_dev *d, void *aux UNUSED)
+{
+  return d->class == 0x01 && d->subclass == 0x01;
+}
+
+/* Looks for a PCI IDE controller that can act as a bus master,
+   enables it to do so, and returns the base of its bus master
+   registers.  Returns 0 if there is none. */
+static uint16_t
+find_bus_master (void)
+{
+  struct pci_dev pci;
+  uint16_t base;
+
+  if (!pci_scan (is_ide_controller, NULL, &pci) || !(pci.prog_if & 0x80))
+    return 0;
+  base = pci_read_bar (&pci, 4);
+  if (base != 0)
+    pci_enable (&pci, PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+  return base;
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -289,6 +399,9 @@ identify_ata_device (struct ata_disk *d)
   snprintf (extra_info, sizeof extra_info,
             "model \"%s\", serial \"%s\"", model, serial);
 
+  /* Word 49 bit 8 says whether the disk supports DMA. */
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
      allow access to those, we're less likely to scribble on
@@ -344,16 +457,9 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  struct block_segment seg = { buffer, 1 };
+  struct block_request req = { sec_no, &seg, 1 };
+  transfer (d_, &req, false);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -364,36 +470,288 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  struct block_segment seg = { (void *) buffer, 1 };
+  struct block_request req = { sec_no, &seg, 1 };
+  transfer (d_, &req, true);
+}
+
+/* Reads the consecutive sectors described by REQ from disk D
+   into REQ's segments.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multi (void *d_, const struct block_request *req)
+{
+  transfer (d_, req, false);
+}
+
+/* Writes the consecutive sectors described by REQ to disk D from
+   REQ's segments.  Returns after the disk has acknowledged
+   receiving all of the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multi (void *d_, const struct block_request *req)
+{
+  transfer (d_, req, true);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi,
+    NULL
   };
 
+/* Transfers the sectors described by REQ between disk D and
+   memory, reading them if WRITE is false and writing them if it
+   is true, up to MAX_MULTI_SECTORS per command. */
+static void
+transfer (struct ata_disk *d, const struct block_request *req, bool write)
+{
+  struct channel *c = d->channel;
+  block_sector_t sec_no = req->sector;
+  size_t left = block_request_size (req);
+  size_t seg = 0, ofs = 0;
+
+  lock_acquire (&c->lock);
+  while (left > 0)
+    {
+      size_t cnt = left < MAX_MULTI_SECTORS ? left : MAX_MULTI_SECTORS;
+
+      if (!d->dma || !dma_transfer (d, sec_no, cnt, req, &seg, &ofs, write))
+        pio_transfer (d, sec_no, cnt, req, &seg, &ofs, write);
+      sec_no += cnt;
+      left -= cnt;
+    }
+  lock_release (&c->lock);
+}
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   the memory in REQ that starts at sector *OFS of segment *SEG,
+   with one PIO data phase per sector, and advances *SEG and *OFS
+   past them.  D's channel must be locked. */
+static void
+pio_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const struct block_request *req, size_t *seg, size_t *ofs,
+              bool write)
+{
+  struct channel *c = d->channel;
+  size_t i;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_SECTOR_RETRY
+                              : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    if (write)
+      {
+        if (!wait_while_busy (d))
+          PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                 d->name, sec_no + i);
+        output_sector (c, next_buffer (req, seg, ofs));
+        sema_down (&c->completion_wait);
+      }
+    else
+      {
+        sema_down (&c->completion_wait);
+        if (!wait_while_busy (d))
+          PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                 d->name, sec_no + i);
+        input_sector (c, next_buffer (req, seg, ofs));
+      }
+}
+
+/* Fills in the PRD table of channel C for the CNT sectors of REQ
+   that start at sector *OFS of segment *SEG, and advances *SEG
+   and *OFS past them.  Returns false if some of that memory
+   cannot be reached by DMA or the table is too small. */
+static bool
+build_prdt (struct channel *c, const struct block_request *req,
+            size_t *seg, size_t *ofs, size_t cnt)
+{
+  size_t n = 0;
+
+  while (cnt > 0)
+    {
+      const struct block_segment *s;
+      uint8_t *buffer;
+      size_t take, size;
+
+      while (*ofs >= req->segs[*seg].cnt)
+        {
+          (*seg)++;
+          *ofs = 0;
+        }
+      s = &req->segs[*seg];
+      take = s->cnt - *ofs < cnt ? s->cnt - *ofs : cnt;
+      buffer = (uint8_t *) s->buffer + *ofs * BLOCK_SECTOR_SIZE;
+      if (!is_kernel_vaddr (buffer) || vtop (buffer) % 2 != 0)
+        return false;
+      *ofs += take;
+      cnt -= take;
+
+      /* Kernel virtual memory maps physical memory one to one, so
+         the buffer is contiguous, but a descriptor may not cross
+         a 64 kB boundary. */
+      for (size = take * BLOCK_SECTOR_SIZE; size > 0; )
+        {
+          uintptr_t addr = vtop (buffer);
+          size_t piece = 0x10000 - (addr & 0xffff);
+
+          if (piece > size)
+            piece = size;
+          if (n >= PRD_CNT)
+            return false;
+          c->prdt[n].addr = addr;
+          c->prdt[n].size = piece & 0xffff;
+          c->prdt[n].flags = 0;
+          n++;
+          buffer += piece;
+          size -= piece;
+        }
+    }
+  c->prdt[n - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Like pio_transfer(), but has the controller copy the data by
+   DMA, waiting for a single interrupt at the end.  Returns false,
+   without advancing *SEG and *OFS, if DMA cannot be used for
+   this memory or the transfer failed or timed out, in which case
+   the caller should fall back to PIO.  After a failure D uses
+   PIO only. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const struct block_request *req, size_t *seg, size_t *ofs,
+              bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  size_t new_seg = *seg, new_ofs = *ofs;
+  uint8_t status;
+
+  if (!build_prdt (c, req, &new_seg, &new_ofs, cnt))
+    return false;
+
+  /* Point the controller at the table and clear old status. */
+  outl (bm_prdt (c), vtop (c->prdt));
+  outb (bm_command (c), direction);
+  outb (bm_status (c), inb (bm_status (c)) | BM_STA_ERROR | BM_STA_INTR);
+
+  /* Issue the command, then start the engine. */
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (bm_command (c), direction | BM_CMD_START);
+  if (!wait_for_dma (c))
+    {
+      /* Stop the engine and reset the channel, then drop any
+         completion that arrived while doing so. */
+      outb (bm_command (c), direction);
+      printf ("%s: DMA %s timed out, sector=%"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      reset_channel (c);
+      while (sema_try_down (&c->completion_wait))
+        continue;
+      d->dma = false;
+      return false;
+    }
+  outb (bm_command (c), direction);
+
+  status = inb (bm_status (c));
+  outb (bm_status (c), status | BM_STA_ERROR | BM_STA_INTR);
+  if ((status & BM_STA_ERROR) || (inb (reg_alt_status (c)) & STA_ERR))
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->dma = false;
+      return false;
+    }
+
+  *seg = new_seg;
+  *ofs = new_ofs;
+  return true;
+}
+
+/* Waits for the interrupt that ends a DMA transfer on channel C.
+   A delayed work item ups the same semaphore if DMA_TIMEOUT_MS
+   milliseconds pass first.  Returns false in that case. */
+static bool
+wait_for_dma (struct channel *c)
+{
+  int64_t ticks = DIV_ROUND_UP ((int64_t) DMA_TIMEOUT_MS * TIMER_FREQ, 1000);
+  enum intr_level old_level;
+  bool timed_out;
+
+  old_level = intr_disable ();
+  c->dma_waiting = true;
+  c->dma_timed_out = false;
+  c->dma_deadline = timer_ticks () + ticks;
+  intr_set_level (old_level);
+  work_schedule_delayed (&system_wq, &c->dma_timeout, ticks);
+
+  sema_down (&c->completion_wait);
+
+  old_level = intr_disable ();
+  c->dma_waiting = false;
+  timed_out = c->dma_timed_out;
+  intr_set_level (old_level);
+  work_cancel (&c->dma_timeout);
+  return !timed_out;
+}
+
+/* Watchdog for DMA transfers on channel C_: wakes up
+   wait_for_dma() if the transfer it waits for is still running
+   at its deadline.  The work item may be run late, after that
+   transfer ended and another one started, which is why the
+   deadline is checked. */
+static void
+dma_timeout (void *c_)
+{
+  struct channel *c = c_;
+  enum intr_level old_level = intr_disable ();
+
+  if (c->dma_waiting && !c->dma_timed_out
+      && timer_ticks () >= c->dma_deadline)
+    {
+      c->dma_timed_out = true;
+      sema_up (&c->completion_wait);
+    }
+  intr_set_level (old_level);
+}
+
+/* Returns the buffer for the next sector of REQ, which is sector
+   *OFS of segment *SEG, and advances *SEG and *OFS past it. */
+static void *
+next_buffer (const struct block_request *req, size_t *seg, size_t *ofs)
+{
+  void *buffer;
+
+  while (*ofs >= req->segs[*seg].cnt)
+    {
+      (*seg)++;
+      *ofs = 0;
+    }
+  buffer = (uint8_t *) req->segs[*seg].buffer + *ofs * BLOCK_SECTOR_SIZE;
+  (*ofs)++;
+  return buffer;
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors CNT to the disk's
+   sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_MULTI_SECTORS);
+  ASSERT (sec_no + cnt <= (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_MULTI_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
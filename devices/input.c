@@ -30,15 +30,30 @@ input_putc (uint8_t key)
 uint8_t
 input_getc (void) 
 {
-  enum intr_level old_level;
   uint8_t key;
 
+  input_read (&key, 1);
+  return key;
+}
+
+/* Retrieves up to SIZE keys from the input buffer into BUF,
+   all that have arrived so far, and returns the number
+   retrieved.  If the buffer is empty, waits for a key to be
+   pressed. */
+size_t
+input_read (void *buf, size_t size)
+{
+  enum intr_level old_level;
+  size_t cnt;
+
+  cnt = intq_read_bulk (&buffer, buf, size);
+
+  /* There may be room to receive from the serial port again. */
   old_level = intr_disable ();
-  key = intq_getc (&buffer);
   serial_notify ();
   intr_set_level (old_level);
-  
-  return key;
+
+  return cnt;
 }
 
 /* Returns true if the input buffer is full,
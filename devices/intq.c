@@ -1,5 +1,6 @@
 #include "devices/intq.h"
 #include <debug.h>
+#include <string.h>
 #include "threads/thread.h"
 
 static int next (int pos);
@@ -74,6 +75,117 @@ intq_putc (struct intq *q, uint8_t byte)
   signal (q, &q->not_empty);
 }
 
+/* Removes up to SIZE bytes from Q into BUFFER and returns the
+   number of bytes removed.  In a kernel thread, sleeps until at
+   least one byte is available, so that the return value is 0
+   only if SIZE is.  In an interrupt handler, never sleeps.
+   Interrupts may be on or off. */
+size_t
+intq_read_bulk (struct intq *q, void *buffer_, size_t size)
+{
+  uint8_t *buffer = buffer_;
+  enum intr_level old_level;
+  size_t cnt = 0;
+  int head, tail;
+
+  if (!intr_context ())
+    lock_acquire (&q->lock);
+
+  /* Wait for data.  The emptiness check is repeated with
+     interrupts off, so that the producer's signal cannot slip in
+     between it and going to sleep. */
+  while (size > 0 && q->head == q->tail && !intr_context ())
+    {
+      old_level = intr_disable ();
+      if (intq_empty (q))
+        wait (q, &q->not_empty);
+      intr_set_level (old_level);
+    }
+
+  /* Copy out everything published so far, in at most two runs,
+     then hand the space back to the producer. */
+  head = q->head;
+  barrier ();
+  tail = q->tail;
+  while (cnt < size && tail != head)
+    {
+      size_t run = (head > tail ? head : INTQ_BUFSIZE) - tail;
+      if (run > size - cnt)
+        run = size - cnt;
+      memcpy (buffer + cnt, q->buf + tail, run);
+      cnt += run;
+      tail = (tail + run) % INTQ_BUFSIZE;
+    }
+  barrier ();
+  q->tail = tail;
+
+  if (cnt > 0)
+    {
+      old_level = intr_disable ();
+      if (!intq_full (q))
+        signal (q, &q->not_full);
+      intr_set_level (old_level);
+    }
+
+  if (!intr_context ())
+    lock_release (&q->lock);
+  return cnt;
+}
+
+/* Adds the SIZE bytes in BUFFER to the end of Q and returns the
+   number of bytes added.  In a kernel thread, sleeps whenever Q
+   is full, so that all SIZE bytes are added.  In an interrupt
+   handler, never sleeps and adds only as many bytes as fit.
+   Interrupts may be on or off. */
+size_t
+intq_write_bulk (struct intq *q, const void *buffer_, size_t size)
+{
+  const uint8_t *buffer = buffer_;
+  enum intr_level old_level;
+  size_t cnt = 0;
+
+  if (!intr_context ())
+    lock_acquire (&q->lock);
+
+  while (cnt < size)
+    {
+      int tail = q->tail;
+      int head = q->head;
+      size_t batch = 0;
+
+      /* Fill the free space, in at most two runs, leaving one
+         slot empty to tell a full queue from an empty one. */
+      barrier ();
+      while (cnt < size && next (head) != tail)
+        {
+          size_t run = (tail > head ? tail - 1
+                        : INTQ_BUFSIZE - (tail == 0)) - head;
+          if (run > size - cnt)
+            run = size - cnt;
+          memcpy (q->buf + head, buffer + cnt, run);
+          cnt += run;
+          batch += run;
+          head = (head + run) % INTQ_BUFSIZE;
+        }
+      barrier ();
+      q->head = head;
+
+      old_level = intr_disable ();
+      if (batch > 0 && !intq_empty (q))
+        signal (q, &q->not_empty);
+      if (cnt < size && !intr_context () && intq_full (q))
+        wait (q, &q->not_full);
+      intr_set_level (old_level);
+
+      if (cnt < size && intr_context ())
+        break;
+    }
+
+  if (!intr_context ())
+    lock_release (&q->lock);
+  return cnt;
+}
+
 /* Returns the position after POS within an intq. */
 static int
 next (int pos) 
@@ -15,7 +15,16 @@
    and condition variables from threads/synch.h cannot be used in
    this case, as they normally would, because they can only
    protect kernel threads from one another, not from interrupt
-   handlers. */
+   handlers.
+
+   The bulk functions, intq_read_bulk() and intq_write_bulk(),
+   move whole buffers and may be called with interrupts on.  The
+   queue is then a lock-free ring with a single producer, which
+   only advances HEAD, and a single consumer, which only advances
+   TAIL.  Interrupts are turned off only briefly, to sleep or to
+   wake up the thread on the other side, and that happens once
+   per call rather than once per byte.  Kernel threads on the
+   same side of a queue are serialized by LOCK. */
 
 /* Queue buffer size, in bytes. */
 #define INTQ_BUFSIZE 64
@@ -30,8 +39,8 @@ struct intq
 
     /* Queue. */
     uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
-    int head;                   /* New data is written here. */
-    int tail;                   /* Old data is read here. */
+    volatile int head;          /* New data is written here. */
+    volatile int tail;          /* Old data is read here. */
   };
 
 void intq_init (struct intq *);
@@ -39,5 +48,7 @@ bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
+size_t intq_read_bulk (struct intq *, void *, size_t);
+size_t intq_write_bulk (struct intq *, const void *, size_t);
 
 #endif /* devices/intq.h */
@@ -0,0 +1,248 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include <stdbool.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Local APIC (Advanced Programmable Interrupt Controller).
+   Refer to [IA32-v3a] chapter 10 "Advanced Programmable
+   Interrupt Controller (APIC)" for details.
+
+   Every CPU has its own local APIC, at the same physical address
+   on each of them.  Pintos only uses the local APICs on a
+   multiprocessor, to start the application processors (APs), to
+   send interrupts from one CPU to another, and as the APs' timer.
+   Device interrupts still come through the PICs, to the
+   bootstrap processor only (see interrupt.c). */
+
+/* Local APIC registers, as byte offsets from its base. */
+#define LAPIC_ID 0x020          /* Local APIC ID. */
+#define LAPIC_TPR 0x080         /* Task priority. */
+#define LAPIC_EOI 0x0b0         /* End of interrupt. */
+#define LAPIC_SVR 0x0f0         /* Spurious interrupt vector. */
+#define LAPIC_ICR_LO 0x300      /* Interrupt command, bits 0...31. */
+#define LAPIC_ICR_HI 0x310      /* Interrupt command, bits 32...63. */
+#define LAPIC_LVT_TIMER 0x320   /* Local vector table: timer. */
+#define LAPIC_LVT_LINT0 0x350   /* Local vector table: LINT0 pin. */
+#define LAPIC_LVT_LINT1 0x360   /* Local vector table: LINT1 pin. */
+#define LAPIC_LVT_ERROR 0x370   /* Local vector table: errors. */
+#define LAPIC_TIMER_INIT 0x380  /* Timer initial count. */
+#define LAPIC_TIMER_CUR 0x390   /* Timer current count. */
+#define LAPIC_TIMER_DIV 0x3e0   /* Timer divide configuration. */
+
+/* Register bits. */
+#define SVR_ENABLE 0x100        /* APIC software enable. */
+#define LVT_NMI 0x400           /* Deliver as a non-maskable interrupt. */
+#define LVT_EXTINT 0x700        /* Deliver as an interrupt from the PICs. */
+#define LVT_MASKED 0x10000      /* Interrupt masked. */
+#define LVT_PERIODIC 0x20000    /* Timer reloads when it reaches 0. */
+#define ICR_INIT 0x500          /* INIT interprocessor interrupt. */
+#define ICR_STARTUP 0x600       /* Start-up interprocessor interrupt. */
+#define ICR_PENDING 0x1000      /* Last command not sent yet. */
+#define ICR_ASSERT 0x4000       /* Assert (not deassert) level. */
+#define ICR_LEVEL 0x8000        /* Level (not edge) triggered. */
+#define TIMER_DIV_1 0xb         /* Timer counts at the bus clock. */
+
+/* The local APIC registers, mapped at their physical address, or
+   a null pointer on a uniprocessor. */
+static volatile uint32_t *lapic;
+
+/* Timer count for one timer tick.  Calibrated by lapic_init(). */
+static uint32_t timer_count;
+
+static intr_handler_func lapic_timer_interrupt;
+static void map_registers (uintptr_t paddr);
+static void enable (void);
+static void calibrate_timer (void);
+static void send_command (uint8_t apic_id, uint32_t command);
+
+/* Returns the value of local APIC register REG. */
+static inline uint32_t
+lapic_read (int reg)
+{
+  return lapic[reg / sizeof *lapic];
+}
+
+/* Writes VALUE to local APIC register REG. */
+static inline void
+lapic_write (int reg, uint32_t value)
+{
+  lapic[reg / sizeof *lapic] = value;
+
+  /* Wait for the write to finish by reading back. */
+  lapic_read (LAPIC_ID);
+}
+
+/* Enables the bootstrap processor's local APIC, whose registers
+   are at physical address PADDR, and calibrates its timer
+   against the timer tick.  Interrupts must be on. */
+void
+lapic_init (uintptr_t paddr)
+{
+  ASSERT (intr_get_level () == INTR_ON);
+
+  map_registers (paddr);
+  enable ();
+
+  /* Keep taking the PICs' interrupts through LINT0. */
+  lapic_write (LAPIC_LVT_LINT0, LVT_EXTINT);
+
+  calibrate_timer ();
+  intr_register_ext (LAPIC_TIMER_VEC, lapic_timer_interrupt,
+                     "Local APIC Timer");
+}
+
+/* Enables the running application processor's local APIC and
+   starts its timer interrupting TIMER_FREQ times per second.
+   lapic_init() must have run on the bootstrap processor. */
+void
+lapic_init_ap (void)
+{
+  ASSERT (lapic != NULL);
+
+  enable ();
+  lapic_write (LAPIC_LVT_LINT0, LVT_MASKED);
+
+  lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_1);
+  lapic_write (LAPIC_LVT_TIMER, LVT_PERIODIC | LAPIC_TIMER_VEC);
+  lapic_write (LAPIC_TIMER_INIT, timer_count);
+}
+
+/* Returns the running CPU's local APIC ID. */
+uint8_t
+lapic_id (void)
+{
+  return lapic_read (LAPIC_ID) >> 24;
+}
+
+/* Signals the end of the interrupt being handled, so that the
+   local APIC can deliver the next one. */
+void
+lapic_eoi (void)
+{
+  lapic_write (LAPIC_EOI, 0);
+}
+
+/* Sends interrupt VEC to the CPU whose local APIC ID is
+   APIC_ID. */
+void
+lapic_send_ipi (uint8_t apic_id, uint8_t vec)
+{
+  send_command (apic_id, vec);
+}
+
+/* Starts the application processor whose local APIC ID is
+   APIC_ID, with the INIT, start-up, start-up sequence of
+   interprocessor interrupts.  It begins executing in real mode
+   at physical address START, which must be page-aligned and in
+   the first megabyte of memory.  Refer to the Intel
+   MultiProcessor Specification, appendix B.4. */
+void
+lapic_start_ap (uint8_t apic_id, uintptr_t start)
+{
+  int i;
+
+  ASSERT (start % PGSIZE == 0 && start < 0x100000);
+
+  send_command (apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+  timer_mdelay (10);
+  send_command (apic_id, ICR_INIT | ICR_LEVEL);
+
+  for (i = 0; i < 2; i++)
+    {
+      send_command (apic_id, ICR_STARTUP | (start >> PGBITS));
+      timer_udelay (200);
+    }
+}
+
+/* Local APIC timer interrupt handler, on application
+   processors. */
+static void
+lapic_timer_interrupt (struct intr_frame *args UNUSED)
+{
+  thread_tick ();
+}
+
+/* Maps the page of local APIC registers at physical address
+   PADDR to the same virtual address in the kernel's page
+   directory, with caching off.  Must be called before any
+   process is created, because pagedir_create() copies the kernel
+   mappings from init_page_dir. */
+static void
+map_registers (uintptr_t paddr)
+{
+  volatile uint32_t *vaddr = (volatile uint32_t *) paddr;
+  uint32_t *pde = &init_page_dir[pd_no ((void *) vaddr)];
+  uint32_t *pt;
+
+  ASSERT (pg_ofs ((void *) vaddr) == 0);
+  ASSERT (paddr >= LOADER_PHYS_BASE + init_ram_pages * PGSIZE);
+
+  if (*pde == 0)
+    *pde = pde_create (palloc_get_page (PAL_ASSERT | PAL_ZERO));
+  pt = pde_get_pt (*pde);
+  pt[pt_no ((void *) vaddr)] = paddr | PTE_PCD | PTE_PWT | PTE_W | PTE_P;
+  lapic = vaddr;
+}
+
+/* Enables the running CPU's local APIC, with every local
+   interrupt masked except NMIs, and discards any interrupt left
+   in service from before. */
+static void
+enable (void)
+{
+  lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+  lapic_write (LAPIC_LVT_TIMER, LVT_MASKED);
+  lapic_write (LAPIC_LVT_LINT1, LVT_NMI);
+  lapic_write (LAPIC_LVT_ERROR, LVT_MASKED);
+  lapic_write (LAPIC_TPR, 0);
+  lapic_write (LAPIC_EOI, 0);
+}
+
+/* Sets timer_count to the number of local APIC timer counts in
+   one timer tick, by letting the timer count down for a few
+   ticks with its interrupt masked.  The timer runs at the bus
+   clock, which is the same for every CPU. */
+static void
+calibrate_timer (void)
+{
+  const int calib_ticks = TIMER_FREQ / 10;
+  int64_t start;
+  uint32_t left;
+
+  lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_1);
+
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    barrier ();
+  start = timer_ticks ();
+  lapic_write (LAPIC_TIMER_INIT, UINT32_MAX);
+  while (timer_elapsed (start) < calib_ticks)
+    barrier ();
+  left = lapic_read (LAPIC_TIMER_CUR);
+  lapic_write (LAPIC_TIMER_INIT, 0);
+
+  timer_count = (UINT32_MAX - left) / calib_ticks;
+}
+
+/* Sends interprocessor interrupt COMMAND to the CPU whose local
+   APIC ID is APIC_ID, and waits until it has gone out.  The two
+   halves of the command are written with interrupts off, so that
+   no interrupt handler on this CPU can send another in between. */
+static void
+send_command (uint8_t apic_id, uint32_t command)
+{
+  enum intr_level old_level = intr_disable ();
+
+  lapic_write (LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+  lapic_write (LAPIC_ICR_LO, command);
+  while (lapic_read (LAPIC_ICR_LO) & ICR_PENDING)
+    barrier ();
+
+  intr_set_level (old_level);
+}
@@ -0,0 +1,19 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdint.h>
+
+/* Interrupt vectors 0xf0...0xff are delivered by the local APIC
+   (see interrupt.c).  These two are its own; the rest are
+   interprocessor interrupts (see cpu.c). */
+#define LAPIC_TIMER_VEC 0xf0    /* Local APIC timer. */
+#define LAPIC_SPURIOUS_VEC 0xff /* Spurious interrupt, no EOI. */
+
+void lapic_init (uintptr_t paddr);
+void lapic_init_ap (void);
+uint8_t lapic_id (void);
+void lapic_eoi (void);
+void lapic_send_ipi (uint8_t apic_id, uint8_t vec);
+void lapic_start_ap (uint8_t apic_id, uintptr_t start);
+
+#endif /* devices/lapic.h */
@@ -317,8 +317,33 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* block_io callback for a transfer passed on by
+   partition_start(). */
+static void
+partition_done (struct block_io *io UNUSED, void *t)
+{
+  block_transfer_done (t);
+}
+
+/* Starts transfer T, relative to the start of partition P, by
+   submitting it to the underlying block device, so that the
+   device's request queue sees the requests of all of its
+   partitions at once. */
+static void
+partition_start (void *p_, struct block_transfer *t)
+{
+  struct partition *p = p_;
+
+  block_io_init (&t->io, t->write, p->start + t->req.sector,
+                 t->req.segs, t->req.seg_cnt, partition_done, t);
+  block_submit (p->block, &t->io);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    NULL,
+    NULL,
+    partition_start
   };
@@ -0,0 +1,127 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* Access to PCI configuration space through configuration
+   mechanism #1, which every PC chipset since the PCI bus was
+   introduced supports, QEMU and Bochs included.  Only what the
+   drivers need is here: finding a device and programming its
+   configuration registers. */
+
+/* Configuration mechanism #1 ports. */
+#define CONFIG_ADDRESS 0xcf8
+#define CONFIG_DATA 0xcfc
+
+/* Limits of the PCI topology. */
+#define BUS_CNT 256
+#define SLOT_CNT 32
+#define FUNC_CNT 8
+
+/* Returns the 32-bit configuration register REG, which must be
+   a multiple of 4, of function FUNC of SLOT on BUS. */
+static uint32_t
+read_config (int bus, int slot, int func, int reg)
+{
+  ASSERT (reg % 4 == 0 && reg < 256);
+  outl (CONFIG_ADDRESS, (0x80000000 | (bus << 16) | (slot << 11)
+                         | (func << 8) | reg));
+  return inl (CONFIG_DATA);
+}
+
+/* Sets the 32-bit configuration register REG, which must be a
+   multiple of 4, of function FUNC of SLOT on BUS to VALUE. */
+static void
+write_config (int bus, int slot, int func, int reg, uint32_t value)
+{
+  ASSERT (reg % 4 == 0 && reg < 256);
+  outl (CONFIG_ADDRESS, (0x80000000 | (bus << 16) | (slot << 11)
+                         | (func << 8) | reg));
+  outl (CONFIG_DATA, value);
+}
+
+/* Calls FUNC, passing AUX, for every PCI function present, until
+   FUNC returns true.  If it does, copies the function it accepted
+   into *FOUND and returns true.  Returns false if FUNC accepted
+   none of them. */
+bool
+pci_scan (pci_scan_func *func, void *aux, struct pci_dev *found)
+{
+  int bus, slot, fn;
+
+  for (bus = 0; bus < BUS_CNT; bus++)
+    for (slot = 0; slot < SLOT_CNT; slot++)
+      for (fn = 0; fn < FUNC_CNT; fn++)
+        {
+          uint32_t id = read_config (bus, slot, fn, 0x00);
+          uint32_t class;
+          struct pci_dev d;
+
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No function 0 means no device in this slot. */
+              if (fn == 0)
+                break;
+              continue;
+            }
+
+          class = read_config (bus, slot, fn, 0x08);
+          d.bus = bus;
+          d.slot = slot;
+          d.func = fn;
+          d.vendor_id = id & 0xffff;
+          d.device_id = id >> 16;
+          d.class = class >> 24;
+          d.subclass = class >> 16;
+          d.prog_if = class >> 8;
+          d.irq = read_config (bus, slot, fn, 0x3c);
+          if (func (&d, aux))
+            {
+              *found = d;
+              return true;
+            }
+
+          /* Only multi-function devices have functions past 0. */
+          if (fn == 0 && !(read_config (bus, slot, 0, 0x0c) & 0x00800000))
+            break;
+        }
+  return false;
+}
+
+/* Returns the 32-bit configuration register REG of D. */
+uint32_t
+pci_read_config (const struct pci_dev *d, int reg)
+{
+  return read_config (d->bus, d->slot, d->func, reg);
+}
+
+/* Sets the 32-bit configuration register REG of D to VALUE. */
+void
+pci_write_config (const struct pci_dev *d, int reg, uint32_t value)
+{
+  write_config (d->bus, d->slot, d->func, reg, value);
+}
+
+/* Returns base address register BAR of D, with the flag bits
+   masked off, so that it is an I/O port for an I/O BAR and a
+   physical address for a memory BAR. */
+uint32_t
+pci_read_bar (const struct pci_dev *d, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (d, PCI_REG_BAR0 + bar * 4);
+  return value & 1 ? value & ~3u : value & ~15u;
+}
+
+/* Sets COMMAND_BITS in D's command register, for example to let
+   it act as a bus master. */
+void
+pci_enable (const struct pci_dev *d, uint16_t command_bits)
+{
+  uint32_t value = pci_read_config (d, PCI_REG_COMMAND);
+
+  /* The status register in the upper half is write-1-to-clear,
+     so write zeros there. */
+  pci_write_config (d, PCI_REG_COMMAND, (value & 0xffff) | command_bits);
+}
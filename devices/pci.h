@@ -0,0 +1,40 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A function of a device on the PCI bus. */
+struct pci_dev
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t slot;               /* Device number on the bus. */
+    uint8_t func;               /* Function number in the device. */
+    uint16_t vendor_id;         /* Vendor ID. */
+    uint16_t device_id;         /* Device ID. */
+    uint8_t class;              /* Base class code. */
+    uint8_t subclass;           /* Subclass code. */
+    uint8_t prog_if;            /* Programming interface. */
+    uint8_t irq;                /* Interrupt line, 0xff if none. */
+  };
+
+/* Configuration space registers. */
+#define PCI_REG_COMMAND 0x04            /* Command (16 bits). */
+#define PCI_REG_BAR0 0x10               /* First base address register. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001               /* Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY 0x0002           /* Respond to memory accesses. */
+#define PCI_CMD_BUS_MASTER 0x0004       /* May act as a bus master. */
+
+/* A function called for each PCI function found.  Returns true
+   to stop the scan. */
+typedef bool pci_scan_func (const struct pci_dev *, void *aux);
+bool pci_scan (pci_scan_func *, void *aux, struct pci_dev *found);
+
+uint32_t pci_read_config (const struct pci_dev *, int reg);
+void pci_write_config (const struct pci_dev *, int reg, uint32_t value);
+uint32_t pci_read_bar (const struct pci_dev *, int bar);
+void pci_enable (const struct pci_dev *, uint16_t command_bits);
+
+#endif /* devices/pci.h */
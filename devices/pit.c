@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -39,6 +36,10 @@
        it is 1, for the second half it is 0.  This is useful for
        generating a tone on a speaker.
 
+     - Mode 0 counts down once and raises its output when the
+       count reaches zero.  It takes a count, not a frequency, so
+       it is set up with pit_start_oneshot() instead.
+
      - Other modes are less useful.
 
    FREQUENCY is the number of periods per second, in Hz. */
@@ -81,3 +82,41 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts a single countdown of COUNT PIT cycles on CHANNEL, in
+   mode 0 ("interrupt on terminal count").  On channel 0 this
+   raises exactly one timer interrupt, after COUNT / PIT_HZ
+   seconds, and none after that until the channel is programmed
+   again.  A COUNT of 0 is treated by the PIT as 65536. */
+void
+pit_start_oneshot (int channel, uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the number of PIT cycles left in CHANNEL's current
+   count.  Uses the counter latch command, so that the two bytes
+   read belong to the same count. */
+uint16_t
+pit_read_count (int channel)
+{
+  enum intr_level old_level;
+  uint16_t count;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, channel << 6);
+  count = inb (PIT_PORT_COUNTER (channel));
+  count |= inb (PIT_PORT_COUNTER (channel)) << 8;
+  intr_set_level (old_level);
+  return count;
+}
@@ -0,0 +1,92 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in kernel memory.
+
+   The contents are held in individually allocated pages, so that
+   a large RAM disk does not need a large run of contiguous
+   memory.  Nothing is preserved across a reboot. */
+
+/* Number of sectors in a page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    uint8_t **pages;            /* Pages holding the sectors. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+/* Number of RAM disks created so far. */
+static int ramdisk_cnt;
+
+static struct block_operations ramdisk_operations;
+
+/* Creates and registers a RAM disk of SIZE sectors with the
+   given TYPE, initially all zeros, and returns it.  Panics if
+   there is not enough memory. */
+struct block *
+ramdisk_create (enum block_type type, block_sector_t size)
+{
+  struct ramdisk *rd;
+  char name[16];
+  size_t i;
+
+  ASSERT (size > 0);
+
+  rd = malloc (sizeof *rd);
+  if (rd == NULL)
+    PANIC ("ramdisk: out of memory");
+  rd->page_cnt = DIV_ROUND_UP (size, SECTORS_PER_PAGE);
+  rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC ("ramdisk: out of memory");
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("ramdisk: out of memory for %'"PRDSNu" sectors", size);
+    }
+
+  snprintf (name, sizeof name, "ram%d", ramdisk_cnt++);
+  return block_register (name, type, NULL, size, &ramdisk_operations, rd);
+}
+
+/* Returns the address of SECTOR in RAM disk RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SEC_NO from RAM disk RD_ into BUFFER. */
+static void
+ramdisk_read (void *rd_, block_sector_t sec_no, void *buffer)
+{
+  memcpy (buffer, sector_addr (rd_, sec_no), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BUFFER to sector SEC_NO of RAM disk RD_. */
+static void
+ramdisk_write (void *rd_, block_sector_t sec_no, const void *buffer)
+{
+  memcpy (sector_addr (rd_, sec_no), buffer, BLOCK_SECTOR_SIZE);
+}
+
+/* Multi-sector requests are served a sector at a time by the
+   block layer, which costs no more than copying them here. */
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+    NULL
+  };
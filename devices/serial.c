@@ -129,6 +129,43 @@ serial_putc (uint8_t byte)
   intr_set_level (old_level);
 }
 
+/* Sends the SIZE bytes in BUFFER to the serial port.
+
+   With interrupt-driven I/O and interrupts on, the bytes are
+   copied into the transmit queue a run at a time, without
+   turning interrupts off, while the serial interrupt drains it.
+   Otherwise they go out one at a time through serial_putc(). */
+void
+serial_write (const void *buffer_, size_t size)
+{
+  const uint8_t *buffer = buffer_;
+  enum intr_level old_level;
+
+  if (mode != QUEUE || intr_get_level () == INTR_OFF)
+    {
+      while (size-- > 0)
+        serial_putc (*buffer++);
+      return;
+    }
+
+  while (size > 0)
+    {
+      /* Never queue more than the queue holds in one go: the
+         transmit interrupt is only enabled by write_ier() below,
+         so intq_write_bulk() may sleep on a full queue only if
+         the queue was already busy when it started. */
+      size_t chunk = size < INTQ_BUFSIZE - 1 ? size : INTQ_BUFSIZE - 1;
+
+      intq_write_bulk (&txq, buffer, chunk);
+      buffer += chunk;
+      size -= chunk;
+
+      old_level = intr_disable ();
+      write_ier ();
+      intr_set_level (old_level);
+    }
+}
+
 /* Flushes anything in the serial buffer out the port in polling
    mode. */
 void
@@ -1,12 +1,15 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
   
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -20,11 +23,79 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Number of timer interrupts taken since OS booted.  Lower than
+   TICKS when the idle CPU skipped some of them (see below). */
+static int64_t interrupts;
+
+/* PIT cycles in one timer tick. */
+#define CYCLES_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Nanoseconds per second and per timer tick. */
+#define NS_PER_SEC (1000 * 1000 * 1000)
+#define NS_PER_TICK (NS_PER_SEC / TIMER_FREQ)
+
+/* Programming of PIT channel 0.
+
+   Normally the PIT interrupts once per tick (PIT_PERIODIC).  It
+   is switched to one-shot countdowns for two reasons: to fire a
+   high-resolution timer that expires between two ticks
+   (PIT_ONESHOT), and, while the CPU is idle and no sleeping
+   thread is due within the next tick, to skip the ticks nobody
+   is waiting for (PIT_IDLE).  Ticks that pass during an idle
+   countdown are replayed, one thread_idle_tick() each, as soon
+   as the countdown ends, whether by running out or because some
+   other interrupt woke the CPU (see leave_idle()).
+
+   PHASE is the number of PIT cycles of the current tick that had
+   passed when the countdown started, so that ticks keep their
+   period across any number of one-shot interrupts. */
+static enum
+  {
+    PIT_PERIODIC,               /* Mode 2, one interrupt per tick. */
+    PIT_ONESHOT,                /* Mode 0, ends at a timer or tick edge. */
+    PIT_IDLE                    /* Mode 0, ends on a tick edge. */
+  }
+pit_state;
+static uint16_t oneshot_count;  /* PIT cycles the countdown started at. */
+static unsigned phase;          /* Cycles into the tick when it started. */
+static unsigned missed_ticks;   /* Idle ticks not yet replayed. */
+
+/* Time stamp counter.  Calibrated against the timer tick by
+   timer_calibrate(), and then used as the time base for
+   timer_ns() and high-resolution timers. */
+static uint64_t tsc_hz;         /* TSC cycles per second, 0 if unknown. */
+static uint64_t tsc_boot;       /* TSC value at timer_ns() == 0. */
+
+/* Sleeps shorter than this are busy-waited even when they could
+   block: two timer interrupts and two thread switches cost more
+   CPU time than spinning for a few microseconds. */
+#define HR_MIN_SLEEP_NS (20 * 1000)
+
+/* Shortest one-shot countdown we program, in PIT cycles. */
+#define HR_MIN_CYCLES 8
+
+/* A thread sleeping on a high-resolution timer. */
+struct hr_sleeper
+  {
+    struct list_elem elem;      /* Element in hr_sleepers. */
+    int64_t deadline;           /* timer_ns() value to wake up at. */
+    struct thread *thread;      /* Sleeping thread. */
+  };
+
+/* Threads in hr_sleep(), ordered by deadline. */
+static struct list hr_sleepers;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static void timer_program (unsigned now_phase);
+static void leave_idle (void);
+static void replay_missed_ticks (void);
+static bool current_phase (unsigned *now_phase);
+static void hr_sleep (int64_t ns);
+static void hr_wake (void);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -35,15 +106,30 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  list_init (&hr_sleepers);
+  pit_state = PIT_PERIODIC;
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Returns the CPU's time stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  /* See [IA32-v2b] "RDTSC". */
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Calibrates loops_per_tick, used to implement brief delays,
+   and the TSC frequency, used for timer_ns(). */
 void
 timer_calibrate (void) 
 {
   unsigned high_bit, test_bit;
+  uint64_t tsc_start;
+  int64_t start;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
@@ -64,14 +150,34 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  /* Count TSC cycles across a few whole ticks.  Both ends are
+     taken right after a tick, and the count is then continued
+     from the last tick value so that timer_ns() does not jump
+     when it switches from ticks to the TSC. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  start = ticks;
+  tsc_start = rdtsc ();
+  while (ticks < start + TIMER_FREQ / 10)
+    barrier ();
+  tsc_hz = (rdtsc () - tsc_start) * TIMER_FREQ / (ticks - start);
+  tsc_boot = rdtsc () - ticks * tsc_hz / TIMER_FREQ;
 }
 
-/* Returns the number of timer ticks since the OS booted. */
+/* Returns the number of timer ticks since the OS booted,
+   including those that have passed so far in an idle countdown
+   that is still running. */
 int64_t
 timer_ticks (void) 
 {
   enum intr_level old_level = intr_disable ();
   int64_t t = ticks;
+  unsigned now_phase;
+
+  if (pit_state == PIT_IDLE && current_phase (&now_phase))
+    t += now_phase / CYCLES_PER_TICK;
   intr_set_level (old_level);
   return t;
 }
@@ -84,6 +190,24 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of nanoseconds since the OS booted, from a
+   monotonic clock.  Resolution is that of the TSC once
+   timer_calibrate() has run, and one timer tick before that. */
+int64_t
+timer_ns (void)
+{
+  uint64_t cycles;
+
+  if (tsc_hz == 0)
+    return timer_ticks () * NS_PER_TICK;
+
+  /* Split the conversion so that CYCLES * NS_PER_SEC cannot
+     overflow. */
+  cycles = rdtsc () - tsc_boot;
+  return (cycles / tsc_hz) * NS_PER_SEC
+         + (cycles % tsc_hz) * NS_PER_SEC / tsc_hz;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -120,6 +244,55 @@ timer_nsleep (int64_t ns)
   real_time_sleep (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  If this is the bootstrap processor, which
+   takes the PIT's interrupts, every CPU is idle, no
+   high-resolution timer is pending, and no sleeping thread or
+   delayed work item is due for at least two ticks, replaces the periodic timer interrupt with a single one
+   at the earliest wake-up tick, or as late as the PIT can count,
+   whichever is sooner. */
+void
+timer_idle_enter (void)
+{
+  unsigned now_phase;
+  int64_t next, idle_ticks, max_ticks;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (pit_state != PIT_PERIODIC || !list_empty (&hr_sleepers)
+      || cpu_current () != cpu_bsp () || !cpu_all_idle ())
+    return;
+
+  next = thread_next_wakeup ();
+  if (workqueue_next_due () < next)
+    next = workqueue_next_due ();
+  idle_ticks = next - (ticks + missed_ticks);
+  if (idle_ticks < 2 || !current_phase (&now_phase))
+    return;
+  max_ticks = (UINT16_MAX + now_phase) / CYCLES_PER_TICK;
+  if (idle_ticks > max_ticks)
+    idle_ticks = max_ticks;
+
+  pit_state = PIT_IDLE;
+  phase = now_phase;
+  oneshot_count = idle_ticks * CYCLES_PER_TICK - now_phase;
+  pit_start_oneshot (0, oneshot_count);
+}
+
+/* Called by the scheduler whenever it switches away from the idle
+   thread, which may be from inside the interrupt that ended the
+   halt following timer_idle_enter().  If the idle countdown has
+   not run out yet, the wake-up came from another device: catches
+   up with the idle ticks that have passed so far and goes back
+   to interrupting on every tick. */
+void
+timer_idle_exit (void)
+{
+  enum intr_level old_level = intr_disable ();
+  leave_idle ();
+  intr_set_level (old_level);
+}
+
 /* Busy-waits for approximately MS milliseconds.  Interrupts need
    not be turned on.
 
@@ -163,15 +336,218 @@ timer_ndelay (int64_t ns)
 void
 timer_print_stats (void) 
 {
-  printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  printf ("Timer: %"PRId64" ticks, %"PRId64" interrupts\n",
+          timer_ticks (), interrupts);
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  thread_tick ();
+  bool tick = true;
+
+  interrupts++;
+  if (pit_state != PIT_PERIODIC)
+    {
+      /* A countdown ran out.  An idle countdown always ends on
+         a tick edge, possibly several ticks after it started;
+         any other countdown ends within the tick it started in
+         or exactly on its edge. */
+      unsigned now_phase = phase + oneshot_count;
+      if (pit_state == PIT_IDLE)
+        missed_ticks += now_phase / CYCLES_PER_TICK - 1;
+      tick = now_phase >= CYCLES_PER_TICK;
+      phase = now_phase % CYCLES_PER_TICK;
+
+      /* The PIT is stopped until the end of this handler, which
+         starts the next countdown or goes back to periodic mode
+         if we are on a tick edge. */
+      pit_state = PIT_ONESHOT;
+    }
+  replay_missed_ticks ();
+
+  if (tick)
+    {
+      ticks++;
+      thread_tick ();
+    }
+
+  workqueue_tick (ticks);
+  hr_wake ();
+  if (pit_state != PIT_PERIODIC)
+    timer_program (phase);
+  else if (!list_empty (&hr_sleepers))
+    timer_program (0);
+}
+
+/* Reprograms PIT channel 0 for the next interrupt the timer
+   needs, given that NOW_PHASE cycles of the current tick have
+   passed: the earliest high-resolution timer if it expires
+   within this tick, otherwise the end of the tick.  Periodic
+   mode is kept, or restored if the countdown ended on a tick
+   edge, whenever that gives the same interrupt.  Must not be
+   called during an idle countdown, whose phase can span several
+   ticks; leave_idle() ends one first.
+   Interrupts must be off. */
+static void
+timer_program (unsigned now_phase)
+{
+  unsigned count = CYCLES_PER_TICK - now_phase;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (pit_state != PIT_IDLE);
+  ASSERT (now_phase < CYCLES_PER_TICK);
+
+  if (!list_empty (&hr_sleepers))
+    {
+      struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+                                         struct hr_sleeper, elem);
+      int64_t ns = s->deadline - timer_ns ();
+      int64_t cycles = ns > 0 ? DIV_ROUND_UP (ns * PIT_HZ, NS_PER_SEC) : 0;
+      if (cycles < HR_MIN_CYCLES)
+        cycles = HR_MIN_CYCLES;
+      if (cycles < count)
+        {
+          pit_state = PIT_ONESHOT;
+          phase = now_phase;
+          oneshot_count = cycles;
+          pit_start_oneshot (0, oneshot_count);
+          return;
+        }
+    }
+
+  if (pit_state == PIT_PERIODIC)
+    return;
+  if (now_phase == 0)
+    {
+      pit_state = PIT_PERIODIC;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+    }
+  else
+    {
+      pit_state = PIT_ONESHOT;
+      phase = now_phase;
+      oneshot_count = count;
+      pit_start_oneshot (0, oneshot_count);
+    }
+}
+
+/* If an idle countdown is running, goes back to interrupting on
+   every tick and replays the idle ticks that have passed so far,
+   so that timer_ticks() and the sleepers due by now are up to
+   date before anyone else runs.  If the countdown has already
+   run out, leaves it to timer_interrupt().
+   Interrupts must be off. */
+static void
+leave_idle (void)
+{
+  unsigned now_phase;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (pit_state == PIT_IDLE && current_phase (&now_phase))
+    {
+      pit_state = PIT_ONESHOT;
+      timer_program (now_phase % CYCLES_PER_TICK);
+      missed_ticks += now_phase / CYCLES_PER_TICK;
+      replay_missed_ticks ();
+    }
+}
+
+/* Counts the ticks skipped while idle, one thread_idle_tick()
+   each, so that sleepers and the scheduler's periodic work see
+   every tick with its own timer_ticks() value.
+   Interrupts must be off. */
+static void
+replay_missed_ticks (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (missed_ticks > 0)
+    {
+      missed_ticks--;
+      ticks++;
+      thread_idle_tick ();
+    }
+}
+
+/* Stores into *NOW_PHASE the number of PIT cycles that have
+   passed in the current tick, or since the start of the tick an
+   idle countdown started in.  Returns false if a countdown has
+   already run out, in which case its interrupt is pending and
+   timer_interrupt() takes over from there.
+   Interrupts must be off. */
+static bool
+current_phase (unsigned *now_phase)
+{
+  uint16_t left = pit_read_count (0);
+
+  if (pit_state == PIT_PERIODIC)
+    {
+      /* Mode 2 counts down from CYCLES_PER_TICK to 1. */
+      *now_phase = left < CYCLES_PER_TICK ? CYCLES_PER_TICK - left : 0;
+      return true;
+    }
+
+  /* In mode 0 the counter keeps counting down past zero. */
+  if (left == 0 || left > oneshot_count)
+    return false;
+  *now_phase = phase + (oneshot_count - left);
+  return true;
+}
+
+/* Returns true if high-resolution timer A expires before B. */
+static bool
+hr_sleeper_less (const struct list_elem *a_, const struct list_elem *b_,
+                 void *aux UNUSED)
+{
+  const struct hr_sleeper *a = list_entry (a_, struct hr_sleeper, elem);
+  const struct hr_sleeper *b = list_entry (b_, struct hr_sleeper, elem);
+
+  return a->deadline < b->deadline;
+}
+
+/* Blocks the running thread for NS nanoseconds, which may be
+   less than a timer tick.  The PIT is reprogrammed to interrupt
+   at the deadline if that comes before the next tick.  An idle
+   countdown may still be running, if this thread was woken by
+   another device's interrupt before the idle thread could end
+   it, so that is ended first. */
+static void
+hr_sleep (int64_t ns)
+{
+  struct hr_sleeper s;
+  enum intr_level old_level;
+  unsigned now_phase;
+
+  s.thread = thread_current ();
+  old_level = intr_disable ();
+  s.deadline = timer_ns () + ns;
+  leave_idle ();
+  list_insert_ordered (&hr_sleepers, &s.elem, hr_sleeper_less, NULL);
+  if (list_front (&hr_sleepers) == &s.elem && current_phase (&now_phase))
+    timer_program (now_phase);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Wakes up every thread whose high-resolution timer has expired.
+   Called from the timer interrupt. */
+static void
+hr_wake (void)
+{
+  int64_t now = timer_ns ();
+
+  while (!list_empty (&hr_sleepers))
+    {
+      struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+                                         struct hr_sleeper, elem);
+      if (s->deadline > now)
+        break;
+      list_pop_front (&hr_sleepers);
+      thread_unblock (s->thread);
+      intr_yield_on_return ();
+    }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -219,7 +595,10 @@ real_time_sleep (int64_t num, int32_t denom)
   */
   int64_t ticks = num * TIMER_FREQ / denom;
 
+  int64_t ns = num * (NS_PER_SEC / denom);
+
   ASSERT (intr_get_level () == INTR_ON);
+  ASSERT (NS_PER_SEC % denom == 0);
   if (ticks > 0)
     {
       /* We're waiting for at least one full timer tick.  Use
@@ -227,6 +606,12 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
+  else if (tsc_hz != 0 && ns >= HR_MIN_SLEEP_NS)
+    {
+      /* Sub-tick, but long enough to be worth giving up the
+         CPU: block on a high-resolution timer. */
+      hr_sleep (ns);
+    }
   else 
     {
       /* Otherwise, use a busy-wait loop for more accurate
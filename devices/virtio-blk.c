@@ -0,0 +1,494 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is a driver for virtio block devices, as
+   emulated by QEMU with "-drive if=virtio".  It uses the legacy
+   virtio PCI interface described in [Virtio-0.9.5], which QEMU
+   offers alongside the modern one.
+
+   Requests are passed to the device through a virtqueue: a ring
+   of descriptors that each name a buffer in physical memory, an
+   "available" ring into which the driver puts chains of
+   descriptors, and a "used" ring into which the device puts them
+   back when it has carried them out.  Every request is a chain
+   of a header, one descriptor per data segment, and a status
+   byte.  Any number of requests may be outstanding at once, and
+   the device interrupts as it completes them. */
+
+/* PCI identification of a (transitional) virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy virtio registers, relative to the I/O base in BAR 0. */
+#define reg_device_features(D) ((D)->io_base + 0x00)    /* 32 bits. */
+#define reg_guest_features(D) ((D)->io_base + 0x04)     /* 32 bits. */
+#define reg_queue_pfn(D) ((D)->io_base + 0x08)          /* 32 bits. */
+#define reg_queue_size(D) ((D)->io_base + 0x0c)         /* 16 bits. */
+#define reg_queue_select(D) ((D)->io_base + 0x0e)       /* 16 bits. */
+#define reg_queue_notify(D) ((D)->io_base + 0x10)       /* 16 bits. */
+#define reg_status(D) ((D)->io_base + 0x12)             /* 8 bits. */
+#define reg_isr(D) ((D)->io_base + 0x13)                /* 8 bits. */
+#define reg_capacity(D) ((D)->io_base + 0x14)           /* 64 bits. */
+
+/* Device Status Register bits. */
+#define STA_ACKNOWLEDGE 0x01    /* Guest has noticed the device. */
+#define STA_DRIVER 0x02         /* Guest knows how to drive it. */
+#define STA_DRIVER_OK 0x04      /* Driver is ready. */
+#define STA_FAILED 0x80         /* Guest has given up on it. */
+
+/* ISR Status Register bits. */
+#define ISR_QUEUE 0x01          /* A virtqueue has used buffers. */
+
+/* Virtqueue layout.  The ring must be aligned on a page, as must
+   the used ring within it. */
+#define VRING_ALIGN 4096
+
+/* A descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Length of buffer in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor in chain. */
+  };
+#define VRING_DESC_F_NEXT 1     /* The chain continues in NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Device writes, rather than reads. */
+
+/* The available ring, written by the driver. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the driver puts the next entry. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* The used ring, written by the device. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of descriptor chain. */
+    uint32_t len;               /* Bytes written into the chain. */
+  };
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts the next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Request header. */
+struct virtio_blk_hdr
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* In 512-byte units. */
+  };
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+
+/* Request status byte values. */
+#define VIRTIO_BLK_S_OK 0
+
+/* Most data segments in one descriptor chain.  Larger requests
+   are split into several chains. */
+#define MAX_CHAIN_SEGS 64
+
+/* An outstanding request: one descriptor chain, identified by
+   the number of its first descriptor. */
+struct request
+  {
+    struct virtio_blk_hdr hdr;          /* Read by the device. */
+    uint8_t status;                     /* Written by the device. */
+    struct block_transfer *transfer;    /* Transfer it is part of... */
+    struct semaphore *done;             /* ...or semaphore to up. */
+  };
+
+/* A virtio block device. */
+struct virtio_disk
+  {
+    char name[8];                       /* Name, e.g. "vda". */
+    uint16_t io_base;                   /* Base of legacy registers. */
+    uint8_t irq;                        /* Interrupt vector. */
+
+    uint16_t queue_size;                /* Number of descriptors. */
+    struct vring_desc *desc;            /* Descriptor table. */
+    struct vring_avail *avail;          /* Available ring. */
+    struct vring_used *used;            /* Used ring. */
+    uint16_t last_used;                 /* Next used entry to look at. */
+    struct request *requests;           /* Indexed by head descriptor. */
+
+    /* Free descriptors, linked through their NEXT members.
+       Protected by disabling interrupts. */
+    uint16_t free_head;                 /* First free descriptor. */
+    uint16_t free_cnt;                  /* Number of free descriptors. */
+    struct semaphore desc_freed;        /* Upped when some are freed. */
+  };
+
+/* Most virtio block devices we support. */
+#define MAX_DISKS 4
+
+/* The virtio block devices found. */
+static struct virtio_disk disks[MAX_DISKS];
+static size_t disk_cnt;
+
+static struct block_operations virtio_operations;
+
+static bool is_virtio_blk (const struct pci_dev *, void *aux);
+static struct block *init_disk (struct virtio_disk *, const struct pci_dev *);
+static void submit_chain (struct virtio_disk *, bool write,
+                          block_sector_t, const struct block_segment *,
+                          size_t seg_cnt, struct block_transfer *,
+                          struct semaphore *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds and initializes the virtio block devices and registers
+   them as block devices. */
+void
+virtio_blk_init (void)
+{
+  pci_scan (is_virtio_blk, NULL, NULL);
+}
+
+/* pci_scan() callback that sets up device D if it is a virtio
+   block device.  Always returns false, to see every device. */
+static bool
+is_virtio_blk (const struct pci_dev *d, void *aux UNUSED)
+{
+  if (d->vendor_id == VIRTIO_VENDOR_ID
+      && d->device_id == VIRTIO_BLK_DEVICE_ID
+      && disk_cnt < MAX_DISKS)
+    {
+      struct virtio_disk *disk = &disks[disk_cnt];
+      struct block *block;
+
+      snprintf (disk->name, sizeof disk->name, "vd%c", 'a' + disk_cnt);
+      block = init_disk (disk, d);
+      if (block != NULL)
+        {
+          /* The interrupt handler only serves counted disks, so
+             count this one before reading its partition table. */
+          disk_cnt++;
+          partition_scan (block);
+        }
+    }
+  return false;
+}
+
+/* Returns the offset of the used ring in a virtqueue with SIZE
+   descriptors, in the legacy layout: after the descriptor table
+   and the available ring, rounded up to a page. */
+static size_t
+vring_used_ofs (uint16_t size)
+{
+  return ROUND_UP (sizeof (struct vring_desc) * size
+                   + sizeof (struct vring_avail)
+                   + sizeof (uint16_t) * (size + 1), VRING_ALIGN);
+}
+
+/* Returns the number of pages in a virtqueue with SIZE
+   descriptors. */
+static size_t
+vring_pages (uint16_t size)
+{
+  size_t used_bytes = (sizeof (struct vring_used)
+                       + sizeof (struct vring_used_elem) * size
+                       + sizeof (uint16_t));
+  return DIV_ROUND_UP (vring_used_ofs (size) + used_bytes, PGSIZE);
+}
+
+/* Resets and sets up the virtio block device described by PCI
+   as DISK, then registers it.  Returns the new block device, or a
+   null pointer on failure. */
+static struct block *
+init_disk (struct virtio_disk *disk, const struct pci_dev *pci)
+{
+  uint64_t capacity;
+  uint8_t *ring;
+  uint16_t i;
+  size_t j;
+
+  disk->io_base = pci_read_bar (pci, 0);
+  if (disk->io_base == 0 || pci->irq >= 16)
+    {
+      printf ("%s: no I/O ports or interrupt line, ignoring\n", disk->name);
+      return NULL;
+    }
+  disk->irq = pci->irq + 0x20;
+  pci_enable (pci, PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+
+  /* Reset the device and tell it we can drive it.  We need none
+     of its optional features. */
+  outb (reg_status (disk), 0);
+  outb (reg_status (disk), STA_ACKNOWLEDGE);
+  outb (reg_status (disk), STA_ACKNOWLEDGE | STA_DRIVER);
+  outl (reg_guest_features (disk), 0);
+
+  /* Set up request queue 0. */
+  outw (reg_queue_select (disk), 0);
+  disk->queue_size = inw (reg_queue_size (disk));
+  ring = NULL;
+  if (disk->queue_size >= 3)
+    ring = palloc_get_multiple (PAL_ZERO, vring_pages (disk->queue_size));
+  disk->requests = malloc (sizeof *disk->requests * disk->queue_size);
+  if (ring == NULL || disk->requests == NULL)
+    {
+      printf ("%s: cannot set up request queue, ignoring\n", disk->name);
+      outb (reg_status (disk), STA_FAILED);
+      if (ring != NULL)
+        palloc_free_multiple (ring, vring_pages (disk->queue_size));
+      free (disk->requests);
+      return NULL;
+    }
+  disk->desc = (struct vring_desc *) ring;
+  disk->avail = (struct vring_avail *) (ring + sizeof (struct vring_desc)
+                                               * disk->queue_size);
+  disk->used = (struct vring_used *) (ring
+                                      + vring_used_ofs (disk->queue_size));
+  disk->last_used = 0;
+  for (i = 0; i < disk->queue_size; i++)
+    disk->desc[i].next = i + 1;
+  disk->free_head = 0;
+  disk->free_cnt = disk->queue_size;
+  sema_init (&disk->desc_freed, 0);
+  outl (reg_queue_pfn (disk), vtop (ring) / VRING_ALIGN);
+
+  /* Devices may share an interrupt line, so register its handler
+     only once; it serves every disk. */
+  for (j = 0; j < disk_cnt; j++)
+    if (disks[j].irq == disk->irq)
+      break;
+  if (j == disk_cnt)
+    intr_register_ext (disk->irq, interrupt_handler, "virtio-blk");
+  outb (reg_status (disk), STA_ACKNOWLEDGE | STA_DRIVER | STA_DRIVER_OK);
+
+  capacity = inl (reg_capacity (disk));
+  capacity |= (uint64_t) inl (reg_capacity (disk) + 4) << 32;
+  if (capacity > (block_sector_t) -1)
+    capacity = (block_sector_t) -1;
+
+  return block_register (disk->name, BLOCK_RAW, "virtio", capacity,
+                         &virtio_operations, disk);
+}
+
+/* Takes a free descriptor from DISK and returns its number.
+   Interrupts must be off and a descriptor must be free. */
+static uint16_t
+alloc_desc (struct virtio_disk *disk)
+{
+  uint16_t i = disk->free_head;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (disk->free_cnt > 0);
+  disk->free_head = disk->desc[i].next;
+  disk->free_cnt--;
+  return i;
+}
+
+/* Sets descriptor I of DISK to name the SIZE bytes at kernel
+   address BUFFER, with the given FLAGS. */
+static void
+set_desc (struct virtio_disk *disk, uint16_t i, const void *buffer,
+          size_t size, uint16_t flags)
+{
+  ASSERT (is_kernel_vaddr (buffer));
+  disk->desc[i].addr = vtop (buffer);
+  disk->desc[i].len = size;
+  disk->desc[i].flags = flags;
+}
+
+/* Passes the device a request to read or, if WRITE is true,
+   write the sectors starting at SECTOR from or to the SEG_CNT
+   segments in SEGS.  When it completes, the interrupt handler
+   counts it against TRANSFER, if non-null, or ups DONE.  Waits
+   for descriptors to become free if necessary. */
+static void
+submit_chain (struct virtio_disk *disk, bool write, block_sector_t sector,
+              const struct block_segment *segs, size_t seg_cnt,
+              struct block_transfer *transfer, struct semaphore *done)
+{
+  size_t desc_cnt = seg_cnt + 2;
+  struct request *r;
+  enum intr_level old_level;
+  uint16_t head, prev, i;
+  size_t j;
+
+  ASSERT (seg_cnt > 0 && seg_cnt <= MAX_CHAIN_SEGS);
+  ASSERT (desc_cnt <= disk->queue_size);
+
+  old_level = intr_disable ();
+  while (disk->free_cnt < desc_cnt)
+    sema_down (&disk->desc_freed);
+
+  /* Header. */
+  head = alloc_desc (disk);
+  r = &disk->requests[head];
+  r->hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  r->hdr.reserved = 0;
+  r->hdr.sector = sector;
+  r->status = 0xff;
+  r->transfer = transfer;
+  r->done = done;
+  set_desc (disk, head, &r->hdr, sizeof r->hdr, VRING_DESC_F_NEXT);
+
+  /* Data. */
+  prev = head;
+  for (j = 0; j < seg_cnt; j++)
+    {
+      i = alloc_desc (disk);
+      set_desc (disk, i, segs[j].buffer, segs[j].cnt * BLOCK_SECTOR_SIZE,
+                VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE));
+      disk->desc[prev].next = i;
+      prev = i;
+    }
+
+  /* Status. */
+  i = alloc_desc (disk);
+  set_desc (disk, i, &r->status, 1, VRING_DESC_F_WRITE);
+  disk->desc[prev].next = i;
+
+  /* Make the chain available and tell the device. */
+  disk->avail->ring[disk->avail->idx % disk->queue_size] = head;
+  barrier ();
+  disk->avail->idx++;
+  barrier ();
+  outw (reg_queue_notify (disk), 0);
+  intr_set_level (old_level);
+}
+
+/* Submits REQ to DISK as one or more descriptor chains, counting
+   their completions against TRANSFER if non-null, or else
+   waiting for each one in turn. */
+static void
+submit_request (struct virtio_disk *disk, bool write,
+                const struct block_request *req,
+                struct block_transfer *transfer)
+{
+  block_sector_t sector = req->sector;
+  size_t i, n;
+
+  if (transfer != NULL)
+    transfer->parts = DIV_ROUND_UP (req->seg_cnt, MAX_CHAIN_SEGS);
+  for (i = 0; i < req->seg_cnt; i += n)
+    {
+      struct semaphore done;
+      size_t j;
+
+      n = req->seg_cnt - i < MAX_CHAIN_SEGS ? req->seg_cnt - i
+                                              : MAX_CHAIN_SEGS;
+      sema_init (&done, 0);
+      submit_chain (disk, write, sector, req->segs + i, n, transfer, &done);
+      if (transfer == NULL)
+        sema_down (&done);
+      for (j = i; j < i + n; j++)
+        sector += req->segs[j].cnt;
+    }
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER. */
+static void
+virtio_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  struct block_segment seg = { buffer, 1 };
+  struct block_request req = { sec_no, &seg, 1 };
+
+  submit_request (d, false, &req, NULL);
+}
+
+/* Writes BUFFER to sector SEC_NO on disk D. */
+static void
+virtio_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  struct block_segment seg = { (void *) buffer, 1 };
+  struct block_request req = { sec_no, &seg, 1 };
+
+  submit_request (d, true, &req, NULL);
+}
+
+/* Starts transfer T on disk D without waiting for it. */
+static void
+virtio_start (void *d, struct block_transfer *t)
+{
+  submit_request (d, t->write, &t->req, t);
+}
+
+static struct block_operations virtio_operations =
+  {
+    virtio_read,
+    virtio_write,
+    NULL,
+    NULL,
+    virtio_start
+  };
+
+/* Returns the descriptor chain that begins at HEAD to DISK's
+   free list.  Interrupts must be off. */
+static void
+free_chain (struct virtio_disk *disk, uint16_t head)
+{
+  uint16_t i = head;
+
+  for (;;)
+    {
+      bool more = disk->desc[i].flags & VRING_DESC_F_NEXT;
+      uint16_t next = disk->desc[i].next;
+
+      disk->desc[i].next = disk->free_head;
+      disk->free_head = i;
+      disk->free_cnt++;
+      if (!more)
+        break;
+      i = next;
+    }
+  sema_up (&disk->desc_freed);
+}
+
+/* Virtio block interrupt handler.  Completes the requests that
+   each disk on this interrupt line has put in its used ring. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *disk = &disks[i];
+
+      /* Reading the ISR register acknowledges the interrupt. */
+      if (disk->irq != f->vec_no || !(inb (reg_isr (disk)) & ISR_QUEUE))
+        continue;
+
+      barrier ();
+      while (disk->last_used != disk->used->idx)
+        {
+          struct vring_used_elem *e;
+          struct request *r;
+
+          e = &disk->used->ring[disk->last_used % disk->queue_size];
+          r = &disk->requests[e->id];
+          if (r->status != VIRTIO_BLK_S_OK)
+            PANIC ("%s: I/O error at sector %"PRIu64,
+                   disk->name, r->hdr.sector);
+          free_chain (disk, e->id);
+          disk->last_used++;
+
+          if (r->transfer != NULL)
+            {
+              if (--r->transfer->parts == 0)
+                block_transfer_done (r->transfer);
+            }
+          else
+            sema_up (r->done);
+        }
+    }
+}
@@ -0,0 +1,34 @@
+/* iostat.c
+
+   Prints I/O statistics for each block device. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+static void print_dir(const char *dir, const struct block_dir_stats *st) {
+	int i;
+
+	if(st->requests == 0) return;
+	printf("  %s: %llu requests, %llu transfers, %llu sequential, %llu bytes\n",
+	       dir, st->requests, st->transfers, st->sequential, st->bytes);
+	printf("  %s: average queue wait %llu us, latency %llu us\n", dir,
+	       st->wait_ns / st->requests / 1000, st->latency_ns / st->requests / 1000);
+	printf("  %s latency (us):", dir);
+	for(i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+		if(st->latency[i] != 0)
+			printf(" %s%d:%u", i < BLOCK_LATENCY_BUCKETS - 1 ? "<" : ">=",
+			       i < BLOCK_LATENCY_BUCKETS - 1 ? 2 << i : 1 << i, (unsigned)st->latency[i]);
+	printf("\n");
+}
+
+int main(void) {
+	struct block_stats stats;
+	unsigned idx;
+
+	for(idx = 0; blockstats(idx, &stats); idx++) {
+		printf("%s (%s)\n", stats.name, stats.type);
+		print_dir("reads", &stats.read);
+		print_dir("writes", &stats.write);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,712 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+
+/* Buffer cache for the file system device.
+
+   Every sector the file system reads or writes goes through a
+   fixed set of CACHE_SIZE in-memory copies.  Writes only mark a
+   copy dirty; it reaches the disk when it is evicted, when the
+   flusher finds that it has been dirty for longer than
+   cache_flush_age, when it is synced, or when the file system is
+   shut down.  Victims are chosen by the clock algorithm, which
+   gives every recently used entry a second chance.
+
+   The cache lock is not held during disk I/O.  An entry being
+   read in or written back is marked busy instead, and threads
+   that need it wait for io_done; other entries stay usable.
+
+   Sectors written through the journal are marked logged instead.
+   They stay in the cache, untouched by eviction and flushing,
+   until the journal commits them and calls cache_install(). */
+
+/* Number of cached sectors. */
+#define CACHE_SIZE 64
+
+/* Timer ticks a sector may stay dirty before the flusher writes
+   it back.  Set with the -flush-age kernel option. */
+int64_t cache_flush_age = 5 * TIMER_FREQ;
+
+/* Longest the flusher waits between scans, in timer ticks. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector cached here. */
+    bool valid;                         /* Holds a sector? */
+    bool dirty;                         /* Modified since read or written? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    bool logged;                        /* Held for the journal? */
+    bool busy;                          /* Disk I/O in progress? */
+    int64_t dirtied;                    /* Ticks when it became dirty. */
+    block_sector_t owner;               /* Inode of the file whose data
+                                           was last written here, or 0. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static int clock_hand;                  /* Next eviction candidate. */
+
+/* A write of sectors straight from memory to disk, in progress. */
+struct direct_write
+  {
+    struct list_elem elem;              /* Element in direct_writes. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+/* Direct writes in progress.  Their sectors may not be cached
+   until they finish, or the cache could end up with a copy older
+   than the disk's. */
+static struct list direct_writes;
+
+/* Protects all of the above.  Not held during disk I/O. */
+static struct lock cache_lock;
+static struct condition io_done;        /* An entry stopped being busy,
+                                           or a direct write ended. */
+
+/* Serializes write_dirty(), which keeps its bookkeeping in static
+   arrays.  Acquired before the cache lock. */
+static struct lock flush_lock;
+
+/* Writes back old dirty sectors, every so often. */
+static struct work flush_work;
+
+/* Read-ahead requests run here, slightly above default priority
+   so that they get their I/O started while the thread that asked
+   for them is still computing. */
+static struct workqueue readahead_wq;
+
+/* An asynchronous read-ahead request. */
+struct readahead
+  {
+    struct work work;                   /* Runs readahead_work(). */
+    size_t cnt;                         /* Number of sectors. */
+    block_sector_t sectors[];           /* Sectors to load. */
+  };
+
+static work_func flush_old, readahead_work;
+static int64_t flush_interval (void);
+static struct cache_entry *lookup (block_sector_t);
+static struct cache_entry *lookup_idle (block_sector_t);
+static bool range_idle (block_sector_t, size_t cnt);
+static struct cache_entry *get_entry (block_sector_t, bool fill);
+static struct cache_entry *choose_victim (void);
+static void write_back (struct cache_entry *);
+static void mark_dirty (struct cache_entry *);
+static void transfer_direct (bool write, block_sector_t, uint8_t *,
+                             size_t cnt);
+
+/* Selects the dirty entries that write_dirty() writes back. */
+typedef bool select_func (const struct cache_entry *, void *aux);
+static select_func select_unlogged, select_logged, select_old,
+  select_owner;
+static void write_dirty (select_func *, void *aux);
+
+/* Initializes the buffer cache and schedules the work that writes
+   dirty sectors back periodically. */
+void
+cache_init (void)
+{
+  int i;
+
+  lock_init (&cache_lock);
+  cond_init (&io_done);
+  lock_init (&flush_lock);
+  list_init (&direct_writes);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].valid = false;
+      cache[i].busy = false;
+    }
+  clock_hand = 0;
+
+  workqueue_create (&readahead_wq, "readahead", PRI_DEFAULT + 1);
+  work_init (&flush_work, flush_old, NULL);
+  work_schedule_delayed (&system_wq, &flush_work, flush_interval ());
+}
+
+/* Writes all dirty sectors to disk, for shutdown. */
+void
+cache_done (void)
+{
+  cache_flush ();
+}
+
+/* block_io callback for cache_flush() that counts a completed
+   write on the semaphore in AUX. */
+static void
+flush_done (struct block_io *io UNUSED, void *aux)
+{
+  sema_up (aux);
+}
+
+/* Writes every dirty sector in the cache back to disk, except
+   those held for the journal. */
+void
+cache_flush (void)
+{
+  write_dirty (select_unlogged, NULL);
+}
+
+/* Writes every sector held for the journal to disk, and lets the
+   cache treat them like any others from then on.  Called by the
+   journal once they are safely in the log. */
+void
+cache_install (void)
+{
+  write_dirty (select_logged, NULL);
+}
+
+/* Writes back the dirty sectors that were last written with
+   cache_write_file() for the file whose inode is in sector
+   INODE, and waits for them to reach the disk.  Takes time in
+   proportion to the size of the cache, not of the file. */
+void
+cache_sync_file (block_sector_t inode)
+{
+  write_dirty (select_owner, &inode);
+}
+
+/* Selects entries not held for the journal. */
+static bool
+select_unlogged (const struct cache_entry *e, void *aux UNUSED)
+{
+  return !e->logged;
+}
+
+/* Selects entries held for the journal. */
+static bool
+select_logged (const struct cache_entry *e, void *aux UNUSED)
+{
+  return e->logged;
+}
+
+/* Selects entries not held for the journal that became dirty at
+   or before the timer tick in the int64_t that CUTOFF_ points
+   to. */
+static bool
+select_old (const struct cache_entry *e, void *cutoff_)
+{
+  const int64_t *cutoff = cutoff_;
+  return !e->logged && e->dirtied <= *cutoff;
+}
+
+/* Selects entries not held for the journal that hold data of
+   the file whose inode is in the block_sector_t that INODE_
+   points to. */
+static bool
+select_owner (const struct cache_entry *e, void *inode_)
+{
+  const block_sector_t *inode = inode_;
+  return !e->logged && e->owner == *inode;
+}
+
+/* Returns true if some entry that SELECT picks, given AUX, is
+   being written back.  The cache lock must be held. */
+static bool
+writing_back (select_func *select, void *aux)
+{
+  int i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].busy && cache[i].dirty
+        && select (&cache[i], aux))
+      return true;
+  return false;
+}
+
+/* Writes back the dirty entries that SELECT picks, given AUX, in
+   sector order, with each run of consecutive sectors going out as
+   a single request, and clears their dirty and logged flags.  All
+   of the runs are queued before waiting for any of them, so the
+   device can merge and reorder them.  Write-backs of picked
+   entries that are already under way are waited for, so that
+   everything picked is on disk on return.
+   The cache lock must not be held. */
+static void
+write_dirty (select_func *select, void *aux)
+{
+  /* Only used with flush_lock held. */
+  static struct cache_entry *dirty[CACHE_SIZE];
+  static struct block_segment segs[CACHE_SIZE];
+  static struct block_io ios[CACHE_SIZE];
+  struct semaphore done;
+  size_t cnt = 0, io_cnt = 0;
+  size_t i, j;
+
+  lock_acquire (&flush_lock);
+  lock_acquire (&cache_lock);
+  while (writing_back (select, aux))
+    cond_wait (&io_done, &cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].dirty && !cache[i].busy
+        && select (&cache[i], aux))
+      {
+        for (j = cnt; j > 0 && dirty[j - 1]->sector > cache[i].sector; j--)
+          dirty[j] = dirty[j - 1];
+        dirty[j] = &cache[i];
+        cache[i].busy = true;
+        cnt++;
+      }
+  lock_release (&cache_lock);
+
+  /* Nobody changes a busy entry, so its contents can be written
+     without the lock. */
+  sema_init (&done, 0);
+  for (i = 0; i < cnt; i = j)
+    {
+      for (j = i; j < cnt && dirty[j]->sector == dirty[i]->sector + (j - i);
+           j++)
+        {
+          segs[j].buffer = dirty[j]->data;
+          segs[j].cnt = 1;
+        }
+      block_io_init (&ios[io_cnt], true, dirty[i]->sector, segs + i, j - i,
+                     flush_done, &done);
+      block_submit (fs_device, &ios[io_cnt++]);
+    }
+  while (io_cnt-- > 0)
+    sema_down (&done);
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      dirty[i]->dirty = false;
+      dirty[i]->logged = false;
+      dirty[i]->busy = false;
+    }
+  if (cnt > 0)
+    cond_broadcast (&io_done, &cache_lock);
+  lock_release (&cache_lock);
+  lock_release (&flush_lock);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes into BUFFER, starting OFS bytes into
+   SECTOR. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&cache_lock);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR, starting OFS bytes
+   into it.  The rest of the sector is read from disk first,
+   unless the whole sector is being overwritten. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  mark_dirty (e);
+  lock_release (&cache_lock);
+}
+
+/* Like cache_write_at(), but notes that SECTOR now holds data of
+   the file whose inode is in sector INODE, for
+   cache_sync_file(). */
+void
+cache_write_file (block_sector_t sector, block_sector_t inode,
+                  const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  mark_dirty (e);
+  e->owner = inode;
+  lock_release (&cache_lock);
+}
+
+/* Like cache_write_at(), but holds the sector for the journal:
+   it is not written back until cache_install(). */
+void
+cache_write_logged (block_sector_t sector, const void *buffer,
+                    int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  mark_dirty (e);
+  e->logged = true;
+  lock_release (&cache_lock);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR into
+   BUFFER, which must be in kernel memory, without keeping them in
+   the cache.  Sectors that are cached are copied from there; each
+   run of the others goes from the disk straight into BUFFER. */
+void
+cache_read_direct (block_sector_t sector, void *buffer_, size_t cnt)
+{
+  uint8_t *buffer = buffer_;
+  size_t i, start = 0;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i <= cnt; i++)
+    {
+      struct cache_entry *e = i < cnt ? lookup_idle (sector + i) : NULL;
+
+      if (i < cnt && e == NULL)
+        continue;
+      if (e != NULL)
+        {
+          memcpy (buffer + i * BLOCK_SECTOR_SIZE, e->data,
+                  BLOCK_SECTOR_SIZE);
+          e->accessed = true;
+        }
+      if (i > start)
+        {
+          lock_release (&cache_lock);
+          transfer_direct (false, sector + start, buffer
+                           + start * BLOCK_SECTOR_SIZE, i - start);
+          lock_acquire (&cache_lock);
+        }
+      start = i + 1;
+    }
+  lock_release (&cache_lock);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR from
+   BUFFER, which must be in kernel memory, straight to disk.
+   Copies of them in the cache are brought up to date first, which
+   leaves them clean, since the disk will hold the same data,
+   unless they are held for the journal.  Until the write is done,
+   none of these sectors can be brought into the cache, changed
+   there or written back. */
+void
+cache_write_direct (block_sector_t sector, const void *buffer_, size_t cnt)
+{
+  const uint8_t *buffer = buffer_;
+  struct direct_write dw;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  while (!range_idle (sector, cnt))
+    cond_wait (&io_done, &cache_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = lookup (sector + i);
+      if (e != NULL)
+        {
+          memcpy (e->data, buffer + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+          if (!e->logged)
+            e->dirty = false;
+        }
+    }
+  dw.sector = sector;
+  dw.cnt = cnt;
+  list_push_back (&direct_writes, &dw.elem);
+  lock_release (&cache_lock);
+
+  transfer_direct (true, sector, (uint8_t *) buffer, cnt);
+
+  lock_acquire (&cache_lock);
+  list_remove (&dw.elem);
+  cond_broadcast (&io_done, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Reads or, if WRITE is true, writes the CNT sectors starting at
+   SECTOR from or to BUFFER with a single request.  The cache lock
+   must not be held. */
+static void
+transfer_direct (bool write, block_sector_t sector, uint8_t *buffer,
+                 size_t cnt)
+{
+  struct block_segment seg = { buffer, cnt };
+  struct block_request req = { sector, &seg, 1 };
+
+  ASSERT (!lock_held_by_current_thread (&cache_lock));
+
+  if (write)
+    block_write_multi (fs_device, &req);
+  else
+    block_read_multi (fs_device, &req);
+}
+
+/* Starts loading the CNT sectors in SECTORS into the cache in
+   the background, without waiting for the disk.  Sectors that
+   are already cached are skipped.  If memory is short the
+   request is simply dropped: read-ahead is only a hint. */
+void
+cache_readahead (const block_sector_t *sectors, size_t cnt)
+{
+  struct readahead *ra;
+
+  if (cnt == 0)
+    return;
+  ra = malloc (sizeof *ra + cnt * sizeof *sectors);
+  if (ra == NULL)
+    return;
+  ra->cnt = cnt;
+  memcpy (ra->sectors, sectors, cnt * sizeof *sectors);
+  work_init (&ra->work, readahead_work, ra);
+  work_schedule (&readahead_wq, &ra->work);
+}
+
+/* Loads the sectors of read-ahead request RA_ into the cache. */
+static void
+readahead_work (void *ra_)
+{
+  struct readahead *ra = ra_;
+  size_t i;
+
+  for (i = 0; i < ra->cnt; i++)
+    {
+      lock_acquire (&cache_lock);
+      get_entry (ra->sectors[i], true);
+      lock_release (&cache_lock);
+    }
+  free (ra);
+}
+
+/* Returns how long the flusher waits between scans: half of
+   cache_flush_age, but at most FLUSH_INTERVAL. */
+static int64_t
+flush_interval (void)
+{
+  int64_t interval = cache_flush_age / 2;
+
+  if (interval > FLUSH_INTERVAL)
+    interval = FLUSH_INTERVAL;
+  return interval > 0 ? interval : 1;
+}
+
+/* The flusher.  Writes back the sectors that have been dirty for
+   longer than cache_flush_age, in sector order, so that a crash
+   loses at most about that much work while sectors written again
+   soon are written only once, and then schedules itself again
+   after flush_interval().  The free map's pending changes are put
+   into the cache first. */
+static void
+flush_old (void *aux UNUSED)
+{
+  int64_t cutoff;
+
+  free_map_flush ();
+  cutoff = timer_ticks () - cache_flush_age;
+  write_dirty (select_old, &cutoff);
+  work_schedule_delayed (&system_wq, &flush_work, flush_interval ());
+}
+
+/* Returns the entry caching SECTOR, or a null pointer if there
+   is none.  The cache lock must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  int i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Returns true if SECTOR is being written directly.
+   The cache lock must be held. */
+static bool
+in_direct_write (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&direct_writes); e != list_end (&direct_writes);
+       e = list_next (e))
+    {
+      struct direct_write *dw = list_entry (e, struct direct_write, elem);
+      if (sector >= dw->sector && sector - dw->sector < dw->cnt)
+        return true;
+    }
+  return false;
+}
+
+/* Like lookup(), but first waits until SECTOR is neither being
+   written directly nor in an entry that is busy.
+   The cache lock must be held. */
+static struct cache_entry *
+lookup_idle (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  for (;;)
+    {
+      e = lookup (sector);
+      if (!in_direct_write (sector) && (e == NULL || !e->busy))
+        return e;
+      cond_wait (&io_done, &cache_lock);
+    }
+}
+
+/* Returns true if none of the CNT sectors starting at SECTOR is
+   being written directly or is in an entry that is busy.
+   The cache lock must be held. */
+static bool
+range_idle (block_sector_t sector, size_t cnt)
+{
+  struct list_elem *le;
+  int i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].busy && cache[i].sector >= sector
+        && cache[i].sector - sector < cnt)
+      return false;
+  for (le = list_begin (&direct_writes); le != list_end (&direct_writes);
+       le = list_next (le))
+    {
+      struct direct_write *dw = list_entry (le, struct direct_write, elem);
+      if (sector < dw->sector + dw->cnt && dw->sector < sector + cnt)
+        return false;
+    }
+  return true;
+}
+
+/* Returns the entry caching SECTOR, marked as accessed.  If
+   SECTOR is not cached, evicts an entry to make room for it and,
+   if FILL is true, reads it from disk; if FILL is false, the
+   caller is about to overwrite all of it.  Waits while SECTOR's
+   entry is busy, and drops the cache lock while reading or
+   writing back.
+   The cache lock must be held. */
+static struct cache_entry *
+get_entry (block_sector_t sector, bool fill)
+{
+  struct cache_entry *e;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      e = lookup_idle (sector);
+      if (e != NULL)
+        break;
+
+      e = choose_victim ();
+      if (e == NULL)
+        {
+          /* Every entry is busy or held for the journal. */
+          cond_wait (&io_done, &cache_lock);
+          continue;
+        }
+      if (e->valid && e->dirty)
+        {
+          /* The lock was dropped meanwhile, so start over. */
+          write_back (e);
+          continue;
+        }
+
+      e->sector = sector;
+      e->valid = true;
+      e->dirty = false;
+      e->logged = false;
+      e->owner = 0;
+      if (fill)
+        {
+          e->busy = true;
+          lock_release (&cache_lock);
+          block_read (fs_device, sector, e->data);
+          lock_acquire (&cache_lock);
+          e->busy = false;
+          cond_broadcast (&io_done, &cache_lock);
+        }
+      break;
+    }
+  e->accessed = true;
+  return e;
+}
+
+/* Chooses an entry to evict with the clock algorithm: skips, and
+   clears, accessed entries until one turns up that has not been
+   used for a full turn.  Busy entries and entries held for the
+   journal cannot be evicted.  Returns a null pointer if two full
+   turns find nothing.
+   The cache lock must be held. */
+static struct cache_entry *
+choose_victim (void)
+{
+  int i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+      if (!e->valid)
+        return e;
+      if (e->busy || e->logged)
+        continue;
+      if (!e->accessed)
+        return e;
+      e->accessed = false;
+    }
+  return NULL;
+}
+
+/* Writes dirty entry E to disk, dropping the cache lock meanwhile.
+   E is marked busy, so nobody else uses it until it is clean.
+   The cache lock must be held. */
+static void
+write_back (struct cache_entry *e)
+{
+  ASSERT (e->valid && e->dirty && !e->busy);
+
+  e->busy = true;
+  lock_release (&cache_lock);
+  block_write (fs_device, e->sector, e->data);
+  lock_acquire (&cache_lock);
+  e->busy = false;
+  e->dirty = false;
+  cond_broadcast (&io_done, &cache_lock);
+}
+
+/* Marks E dirty, noting when it became so.
+   The cache lock must be held. */
+static void
+mark_dirty (struct cache_entry *e)
+{
+  if (!e->dirty)
+    {
+      e->dirty = true;
+      e->dirtied = timer_ticks ();
+    }
+}
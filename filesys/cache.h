@@ -0,0 +1,28 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+
+/* Timer ticks a sector may stay dirty before being written back. */
+extern int64_t cache_flush_age;
+
+void cache_init (void);
+void cache_done (void);
+void cache_flush (void);
+void cache_install (void);
+void cache_sync_file (block_sector_t inode);
+
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, int ofs, int size);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, int ofs, int size);
+void cache_write_file (block_sector_t, block_sector_t inode,
+                       const void *, int ofs, int size);
+void cache_write_logged (block_sector_t, const void *, int ofs, int size);
+void cache_read_direct (block_sector_t, void *, size_t cnt);
+void cache_write_direct (block_sector_t, const void *, size_t cnt);
+void cache_readahead (const block_sector_t *, size_t cnt);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,188 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the result of looking up a name in a directory, keyed
+   by the directory's inode sector and the name, so that resolving
+   a path again does not have to open the directories along it or
+   read their contents.  Failed lookups are remembered too, as
+   negative entries.
+
+   directory.c keeps the cache exact: dir_add() and dir_remove()
+   overwrite the entry for the name they change, under the same
+   per-directory lock as their lookups, and dir_create() drops
+   whatever is left over from an earlier directory in the same
+   sector.  The least recently used entry is evicted when the
+   cache is full.
+
+   A hit takes a reference to the inode with inode_reserve()
+   before the cache lock is released, and only reads it from disk
+   afterward.  dir_remove() makes the entry negative before it
+   closes the removed inode, so a hit either takes its reference
+   while the inode still has an opener, keeping its sector
+   allocated, or finds the negative entry; it never opens a
+   sector that was freed and reused. */
+
+/* Maximum number of cached entries. */
+#define DCACHE_SIZE 256
+
+/* A cached lookup result. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name looked up in DIR. */
+    block_sector_t sector;              /* Result or DCACHE_NEGATIVE. */
+  };
+
+static struct hash dentries;            /* All entries. */
+static struct list lru_list;            /* Most recently used first. */
+static struct lock dcache_lock;         /* Protects the above. */
+
+static struct dentry *find (block_sector_t dir, const char *name);
+
+/* Returns a hash value for the dentry containing E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A sorts before dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   Returns false if the cache does not know.  Otherwise returns
+   true and stores NAME's inode, opened, in *INODEP, or a null
+   pointer if NAME is known not to exist or the inode cannot be
+   opened.  The caller must close *INODEP. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               struct inode **inodep)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      *inodep = (d->sector != DCACHE_NEGATIVE
+                 ? inode_reserve (d->sector) : NULL);
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+
+  if (d == NULL)
+    return false;
+  inode_load (*inodep);
+  return true;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   DIR has its inode in SECTOR, or does not exist if SECTOR is
+   DCACHE_NEGATIVE. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else
+    {
+      if (hash_size (&dentries) >= DCACHE_SIZE)
+        {
+          /* Recycle the least recently used entry. */
+          d = list_entry (list_pop_back (&lru_list),
+                          struct dentry, lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+        }
+      else
+        d = malloc (sizeof *d);
+      if (d == NULL)
+        goto done;
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_push_front (&lru_list, &d->lru_elem);
+
+ done:
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every entry for names in the directory whose inode is
+   in sector DIR. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru_list); e != list_end (&lru_list); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        {
+          list_remove (&d->lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+          free (d);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer.
+   The cache lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
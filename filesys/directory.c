@@ -1,10 +1,13 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -21,12 +24,173 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* In-memory index of the entries of a directory.
+
+   Built from the directory's contents the first time the
+   directory is searched, kept up to date by dir_add() and
+   dir_remove(), and dropped when the directory's inode is closed
+   for the last time.  It makes looking up, adding and removing a
+   name take constant time however large the directory is. */
+struct dir_index
+  {
+    struct lock lock;                   /* Serializes changes to the dir. */
+    struct hash names;                  /* Slots in use, by name. */
+    struct list free_slots;             /* Slots not in use. */
+    off_t end;                          /* Offset past the last slot. */
+  };
+
+/* One directory entry slot, as seen by the index. */
+struct dir_slot
+  {
+    struct hash_elem hash_elem;         /* Element in names if in use. */
+    struct list_elem list_elem;         /* Element in free_slots if not. */
+    off_t ofs;                          /* Byte offset in the directory. */
+    block_sector_t inode_sector;        /* Sector of the entry's inode. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Serializes building indexes, so that a directory gets only
+   one. */
+static struct lock index_lock;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&index_lock);
+  dcache_init ();
+}
+
+/* Returns a hash value for the name of the slot containing E. */
+static unsigned
+slot_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct dir_slot, hash_elem)->name);
+}
+
+/* Returns true if the slot containing A has a name that sorts
+   before the one containing B. */
+static bool
+slot_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct dir_slot, hash_elem)->name,
+                 hash_entry (b, struct dir_slot, hash_elem)->name) < 0;
+}
+
+/* Frees the slot containing E. */
+static void
+slot_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct dir_slot, hash_elem));
+}
+
+/* Frees INDEX, which may be a null pointer. */
+void
+dir_index_destroy (struct dir_index *index)
+{
+  if (index == NULL)
+    return;
+  hash_destroy (&index->names, slot_free);
+  while (!list_empty (&index->free_slots))
+    free (list_entry (list_pop_front (&index->free_slots),
+                      struct dir_slot, list_elem));
+  free (index);
+}
+
+/* Returns the name index of the directory in INODE, building it
+   from the directory's entries if it does not have one yet.
+   Returns a null pointer if memory runs out. */
+static struct dir_index *
+get_index (struct inode *inode)
+{
+  struct dir_index **indexp = inode_dir_index (inode);
+  struct dir_index *index;
+  struct dir_entry e;
+  off_t ofs;
+
+  lock_acquire (&index_lock);
+  index = *indexp;
+  if (index != NULL)
+    goto done;
+
+  index = malloc (sizeof *index);
+  if (index == NULL)
+    goto done;
+  lock_init (&index->lock);
+  hash_init (&index->names, slot_hash, slot_less, NULL);
+  list_init (&index->free_slots);
+
+  for (ofs = 0; inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    {
+      struct dir_slot *slot = malloc (sizeof *slot);
+      if (slot == NULL)
+        {
+          index->end = ofs;
+          dir_index_destroy (index);
+          index = NULL;
+          goto done;
+        }
+      slot->ofs = ofs;
+      if (e.in_use)
+        {
+          slot->inode_sector = e.inode_sector;
+          strlcpy (slot->name, e.name, sizeof slot->name);
+          hash_insert (&index->names, &slot->hash_elem);
+        }
+      else
+        list_push_back (&index->free_slots, &slot->list_elem);
+    }
+  index->end = ofs;
+  *indexp = index;
+
+ done:
+  lock_release (&index_lock);
+  return index;
+}
+
+/* Returns the slot named NAME in INDEX, or a null pointer if
+   there is none.  INDEX's lock must be held. */
+static struct dir_slot *
+find_slot (struct dir_index *index, const char *name)
+{
+  struct dir_slot key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&index->lock));
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&index->names, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dir_slot, hash_elem) : NULL;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, with PARENT_SECTOR as its parent directory.  The
+   "." and ".." entries are added.  Returns true if successful,
+   false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt,
+            block_sector_t parent_sector)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir *dir;
+  bool success;
+
+  if (!inode_create (sector, entry_cnt * sizeof (struct dir_entry), true))
+    return false;
+
+  /* Forget lookups in any directory that used this sector
+     before. */
+  dcache_invalidate_dir (sector);
+
+  dir = dir_open (inode_open (sector));
+  success = (dir != NULL
+             && dir_add (dir, ".", sector)
+             && dir_add (dir, "..", parent_sector));
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,53 +247,68 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
-static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+/* Returns true if DIR contains no entries besides "." and "..". */
+bool
+dir_is_empty (struct dir *dir)
 {
-  struct dir_entry e;
-  size_t ofs;
-  
-  ASSERT (dir != NULL);
-  ASSERT (name != NULL);
+  struct dir_index *index = get_index (dir->inode);
+  bool empty;
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  if (index == NULL)
+    return false;
+  lock_acquire (&index->lock);
+  empty = hash_size (&index->names) <= 2;
+  lock_release (&index->lock);
+  return empty;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Nothing, not even "." or "..", is found in a removed
+   directory. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  block_sector_t sector;
+  struct dir_index *index;
+  struct dir_slot *slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  /* A cached answer avoids building or consulting the index,
+     and so reading the directory. */
+  *inode = NULL;
+  if (inode_is_removed (dir->inode))
+    return false;
+  if (dcache_lookup (dir_sector, name, inode))
+    return *inode != NULL;
+
+  index = get_index (dir->inode);
+  if (index == NULL)
+    return false;
+
+  /* The answer is cached under the directory's lock, so that it
+     cannot be overtaken by a dir_add() or dir_remove().  Nothing
+     is found, or cached, in a directory removed meanwhile, whose
+     sector may be reused. */
+  lock_acquire (&index->lock);
+  slot = NULL;
+  if (!inode_is_removed (dir->inode))
+    {
+      slot = find_slot (index, name);
+      sector = slot != NULL ? slot->inode_sector : DCACHE_NEGATIVE;
+      dcache_insert (dir_sector, name, sector);
+    }
+  if (slot != NULL)
+    *inode = inode_reserve (sector);
+  lock_release (&index->lock);
 
-  return *inode != NULL;
+  return inode_load (*inode) != NULL;
 }
 
 /* Adds a file named NAME to DIR, which must not already contain a
@@ -141,8 +320,9 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index *index;
+  struct dir_slot *slot;
   struct dir_entry e;
-  off_t ofs;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,70 +332,125 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  index = get_index (dir->inode);
+  if (index == NULL)
+    return false;
+  lock_acquire (&index->lock);
+
+  /* Check that NAME is not in use, and that the directory has not
+     been removed. */
+  if (find_slot (index, name) != NULL || inode_is_removed (dir->inode))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Take a free slot, or append one at the end of the
+     directory. */
+  if (!list_empty (&index->free_slots))
+    slot = list_entry (list_pop_front (&index->free_slots),
+                       struct dir_slot, list_elem);
+  else
+    {
+      slot = malloc (sizeof *slot);
+      if (slot == NULL)
+        goto done;
+      slot->ofs = index->end;
+      index->end += sizeof e;
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = inode_write_at (dir->inode, &e, sizeof e, slot->ofs) == sizeof e;
+
+  if (success)
+    {
+      slot->inode_sector = inode_sector;
+      strlcpy (slot->name, name, sizeof slot->name);
+      hash_insert (&index->names, &slot->hash_elem);
+      dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+    }
+  else
+    list_push_front (&index->free_slots, &slot->list_elem);
 
  done:
+  lock_release (&index->lock);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs
+   if there is no file with the given NAME, if NAME is "." or
+   "..", or if it is a directory that is not empty. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_index *index, *child = NULL;
+  struct dir_slot *slot;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (!strcmp (name, ".") || !strcmp (name, ".."))
+    return false;
+
+  index = get_index (dir->inode);
+  if (index == NULL)
+    return false;
+  lock_acquire (&index->lock);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  slot = find_slot (index, name);
+  if (slot == NULL)
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (slot->inode_sector);
   if (inode == NULL)
     goto done;
 
+  /* Only empty directories may be removed.  The directory's own
+     lock is held from the check until it is marked removed, so
+     that a thread that already has it open, say as its working
+     directory, cannot add an entry in between.  Locks are always
+     taken parent first. */
+  if (inode_is_dir (inode))
+    {
+      child = get_index (inode);
+      if (child == NULL)
+        goto done;
+      lock_acquire (&child->lock);
+      if (hash_size (&child->names) > 2)
+        goto done;
+    }
+
   sema_down(inode_sema(inode));
 
   /* Erase directory entry. */
+  memset (&e, 0, sizeof e);
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) {
+  if (inode_write_at (dir->inode, &e, sizeof e, slot->ofs) != sizeof e) {
 	  sema_up(inode_sema(inode));
 	  goto done;
   }
+  hash_delete (&index->names, &slot->hash_elem);
+  list_push_front (&index->free_slots, &slot->list_elem);
+  dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
 
-  /* Remove inode. */
+  /* Remove inode.  A removed directory's cached names, "." and
+     ".." among them, must not be found any more. */
   inode_remove (inode);
+  if (child != NULL)
+    dcache_invalidate_dir (inode_get_inumber (inode));
   success = true;
   sema_up(inode_sema(inode));
 
  done:
+  if (child != NULL)
+    lock_release (&child->lock);
+  lock_release (&index->lock);
   inode_close (inode);
   return success;
 }
@@ -225,13 +460,24 @@ dir_remove (struct dir *dir, const char *name)
    contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  return dir_readdir_at (dir->inode, &dir->pos, name);
+}
+
+/* Reads the directory entry of the directory in INODE that
+   follows byte offset *POS, stores its name in NAME, and
+   advances *POS past it.  The "." and ".." entries are skipped.
+   Returns true if successful, false if the directory contains no
+   more entries. */
+bool
+dir_readdir_at (struct inode *inode, off_t *pos, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (inode_read_at (inode, &e, sizeof e, *pos) == sizeof e) 
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      *pos += sizeof e;
+      if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
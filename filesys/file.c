@@ -1,28 +1,29 @@
 #include "filesys/file.h"
+#include <bitmap.h>
 #include <debug.h>
-#include <list.h>
-#include <skip_list.h>
+#include <string.h>
 #include "filesys/inode.h"
+#include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
-#include "threads/interrupt.h"
 #include "threads/synch.h"
 #ifdef USERPROG
 #include "userprog/syscall.h"
 #endif
 
-/* file descriptor skip lists. */
-struct list fd_trash_list;
-int max_fd = 2;
-
-struct fd {
-	int fd;
-	struct file* file;
-	struct skip_list_elem elem;
-	struct list_elem trash_elem;
+/* Per-process file descriptor table.
+   Files are indexed directly by fd, and used tracks which slots
+   are taken so that a new fd is always the lowest free one.  Only
+   the owning thread touches its table, so it needs no lock. */
+struct fd_table {
+	struct file **files;		/* Open files, indexed by fd */
+	struct bitmap *used;		/* Slots in use, including 0 and 1 */
+	size_t cnt;					/* Number of slots */
 };
 
-struct lock fd_lock;
+/* Initial number of slots in a fd table. It doubles when full. */
+#define FD_TABLE_INIT 16
 
 /* An open file. */
 struct file 
@@ -30,8 +31,19 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Read-ahead state, see file_readahead(). */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of data already read ahead. */
+    off_t ra_window;            /* Bytes to keep read ahead. */
   };
 
+/* Read-ahead window sizes, in bytes. */
+#define RA_MIN (4 * BLOCK_SECTOR_SIZE)
+#define RA_MAX (INODE_READAHEAD_MAX * BLOCK_SECTOR_SIZE)
+
+static void file_readahead (struct file *, off_t pos, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -91,11 +103,62 @@ file_read (struct file *file, void *buffer, off_t size)
 {
   sema_down(file_sema(file));
   off_t readed_bytes = inode_read_at (file->inode, buffer, size, file->pos);
+  file_readahead (file, file->pos, readed_bytes);
   file->pos += readed_bytes;
   sema_up(file_sema(file));
   return readed_bytes;
 }
 
+/* Like file_read(), but moves whole sectors straight from the
+   disk into BUFFER, which must stay in memory meanwhile, and
+   does not read ahead: that would only put a copy back into the
+   buffer cache. */
+off_t
+file_read_direct (struct file *file, void *buffer, off_t size)
+{
+  off_t bytes_read;
+
+  sema_down (file_sema (file));
+  bytes_read = inode_read_direct (file->inode, buffer, size, file->pos);
+  file->pos += bytes_read;
+  sema_up (file_sema (file));
+  return bytes_read;
+}
+
+/* Called after SIZE bytes were read from FILE at POS.  While
+   reads stay sequential, keeps the next RA_WINDOW bytes of the
+   file on their way into the buffer cache, doubling the window
+   on every sequential read up to RA_MAX.  A read anywhere else
+   closes the window again. */
+static void
+file_readahead (struct file *file, off_t pos, off_t size)
+{
+  off_t start, end;
+
+  if (size == 0)
+    return;
+  if (pos == file->ra_next)
+    file->ra_window = (file->ra_window == 0 ? RA_MIN
+                       : file->ra_window * 2 < RA_MAX ? file->ra_window * 2
+                       : RA_MAX);
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  file->ra_next = pos + size;
+  if (file->ra_window == 0)
+    return;
+
+  start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  end = file->ra_next + file->ra_window;
+  if (start < end)
+    {
+      inode_readahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -107,35 +170,99 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
   return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Most bytes written in one journal transaction.  A chunk this
+   size spans at most 128 data sectors, which lie under at most
+   two second-level index blocks, so writing it logs at most the
+   inode, the indirect and doubly indirect blocks and those two:
+   5 sectors, within the journal's per-transaction limit. */
+#define WRITE_CHUNK (64 * 1024)
+
+/* Writes SIZE bytes from BUFFER into FILE at *POSP, advancing
+   *POSP, in chunks of at most WRITE_CHUNK bytes that each run as
+   a journal transaction.  If SEMA is not null, holds it while
+   writing each chunk; the transaction begins first, because
+   waiting for the journal while holding it could deadlock.  If
+   DIRECT is true, whole sectors go straight to disk.  Returns the
+   number of bytes written. */
+static off_t
+write_chunks (struct file *file, const uint8_t *buffer, off_t size,
+              off_t *posp, struct semaphore *sema, bool direct)
+{
+  off_t bytes_written = 0;
+
+  while (bytes_written < size)
+    {
+      off_t chunk = size - bytes_written;
+      off_t n;
+
+      if (chunk > WRITE_CHUNK)
+        chunk = WRITE_CHUNK;
+      journal_begin ();
+      if (sema != NULL)
+        sema_down (sema);
+      if (direct)
+        n = inode_write_direct (file->inode, buffer + bytes_written, chunk,
+                                *posp);
+      else
+        n = inode_write_at (file->inode, buffer + bytes_written, chunk,
+                            *posp);
+      *posp += n;
+      if (sema != NULL)
+        sema_up (sema);
+      journal_end ();
+
+      bytes_written += n;
+      if (n < chunk)
+        break;
+    }
+  return bytes_written;
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  sema_down(file_sema(file));
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
-  file->pos += bytes_written;
-  sema_up(file_sema(file));
-  return bytes_written;
+  return write_chunks (file, buffer, size, &file->pos, file_sema (file),
+                       false);
+}
+
+/* Like file_write(), but moves whole sectors of BUFFER, which
+   must stay in memory meanwhile, straight to disk. */
+off_t
+file_write_direct (struct file *file, const void *buffer, off_t size)
+{
+  return write_chunks (file, buffer, size, &file->pos, file_sema (file),
+                       true);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
                off_t file_ofs) 
 {
-  return inode_write_at (file->inode, buffer, size, file_ofs);
+  return write_chunks (file, buffer, size, &file_ofs, NULL, false);
+}
+
+/* Reads the next entry of the directory open as FILE, other than
+   "." and "..", into NAME, and advances FILE's position past it.
+   Returns false if FILE is not a directory or if it has no more
+   entries. */
+bool
+file_readdir (struct file *file, char name[NAME_MAX + 1])
+{
+  if (!inode_is_dir (file->inode))
+    return false;
+  return dir_readdir_at (file->inode, &file->pos, name);
 }
 
 /* Prevents write operations on FILE's underlying inode
@@ -192,91 +319,80 @@ file_tell (struct file *file)
   return file->pos;
 }
 
-/* less function for skip list */
-static bool less_fd_list(const struct skip_list_elem *a, const struct skip_list_elem *b, void *aux) {
-	if((skip_list_entry(a, struct fd, elem)->fd) < (skip_list_entry(b, struct fd, elem)->fd)) return true;
-	return false;
-}
-
-/* get skip list elem of fd */
-static struct skip_list_elem* elem_of_fd(int fd, struct thread *t) {
-    if(t->fd_list == NULL) return NULL;
-	struct fd f;
-	f.fd = fd;
-	return skip_list_search(t->fd_list, &f.elem, less_fd_list, NULL);
-}
-
-
-/* initialize file descriptor */
-void file_fd_init(void) {
-	list_init(&fd_trash_list);
-	lock_init(&fd_lock);
-	max_fd = 2;
-}
-
-/* free all fds in trash list. It might be called when pintos terminates */
-void file_fd_done(void) {
-	struct list_elem *e;
-	struct fd *f;
-	while(!list_empty(&fd_trash_list)) {
-		e = list_pop_front(&fd_trash_list);
-		f = list_entry(e, struct fd, elem);
-		free(f);
+/* grow FDS to CNT slots, keeping its fds. returns false if memory runs out */
+static bool fd_table_grow(struct fd_table *fds, size_t cnt) {
+	struct file **files = calloc(cnt, sizeof *files);
+	struct bitmap *used = bitmap_create(cnt);
+	if(files == NULL || used == NULL) {
+		free(files);
+		if(used != NULL) bitmap_destroy(used);
+		return false;
+	}
+	if(fds->files != NULL) {
+		size_t i;
+		memcpy(files, fds->files, fds->cnt * sizeof *files);
+		for(i = 0; i < fds->cnt; i++)
+			bitmap_set(used, i, bitmap_test(fds->used, i));
+		free(fds->files);
+		bitmap_destroy(fds->used);
 	}
+	else bitmap_set_multiple(used, 0, 2, true);	// fd 0 and 1 are the console.
+	fds->files = files;
+	fds->used = used;
+	fds->cnt = cnt;
+	return true;
 }
 
-/* make new file descriptor and return value of fd */
+/* make new file descriptor and return value of fd, or -1 if memory runs out */
 int file_new_fd(struct file* file, struct thread *t) {
-	lock_acquire(&fd_lock);
-	struct fd *f;
-	if(list_empty(&fd_trash_list)) {
-		f = (struct fd*)malloc(sizeof(struct fd));
-		f->fd = max_fd++;
+	struct fd_table *fds = t->fds;
+	size_t fd;
+	if(fds == NULL) {
+		fds = calloc(1, sizeof *fds);
+		if(fds == NULL) return -1;
+		if(!fd_table_grow(fds, FD_TABLE_INIT)) {
+			free(fds);
+			return -1;
+		}
+		t->fds = fds;
 	}
-	else f = list_entry(list_pop_front(&fd_trash_list), struct fd, trash_elem);
-	f->file = file;
-    if(t->fd_list == NULL) {
-        t->fd_list = (struct skip_list*)malloc(sizeof(struct skip_list));
-        skip_list_init(t->fd_list);
-    }
-	skip_list_insert(t->fd_list, &f->elem, less_fd_list, NULL);
-	lock_release(&fd_lock);
-	return f->fd;
+	fd = bitmap_scan_and_flip(fds->used, 0, 1, false);
+	if(fd == BITMAP_ERROR) {
+		fd = fds->cnt;
+		if(!fd_table_grow(fds, fds->cnt * 2)) return -1;
+		bitmap_mark(fds->used, fd);
+	}
+	fds->files[fd] = file;
+	return fd;
 }
 
 /* remove file descriptor */
 void file_remove_fd(int fd, struct thread *t) {
-    if(t->fd_list == NULL) return;
-	struct skip_list_elem *e = elem_of_fd(fd, t);
-	if(e != NULL) {
-		enum intr_level old_level = intr_disable();
-		skip_list_remove(t->fd_list, e);
-		list_push_back(&fd_trash_list, &(skip_list_entry(e, struct fd, elem)->trash_elem)); 	// insert removed fd into trash fd list.
-		intr_set_level(old_level);
-	}
+	struct fd_table *fds = t->fds;
+	if(fds == NULL || fd < 2 || (size_t)fd >= fds->cnt) return;
+	fds->files[fd] = NULL;
+	bitmap_reset(fds->used, fd);
 }
 
 /* get file pointer of file descriptor */
 struct file* file_of_fd(int fd, struct thread *t) {
-	struct skip_list_elem *e = elem_of_fd(fd, t);
-	if(e == NULL) return NULL;
-	return (skip_list_entry(e, struct fd, elem))->file;
+	struct fd_table *fds = t->fds;
+	if(fds == NULL || fd < 0 || (size_t)fd >= fds->cnt) return NULL;
+	return fds->files[fd];
 }
 
-/* move out all fds in thread. And close all files this thread opened.
+/* close all files this thread opened and free its fd table.
    This might be called when thread is terminating */
 void file_remove_all_fd(struct thread *t) {
-	struct skip_list_elem *e;
-	struct fd *f;
-	if(t->fd_list == NULL || skip_list_empty(t->fd_list, 0)) return;
-	enum intr_level old_level = intr_disable();
-	for(e = skip_list_begin(t->fd_list, 0); e != skip_list_end(t->fd_list);) {
-		f = list_entry(e, struct fd, elem);
-		file_close(f->file);
-		e = skip_list_remove(t->fd_list, e);
-		list_push_back(&fd_trash_list, &f->trash_elem);
-	}
-	intr_set_level(old_level);
+	struct fd_table *fds = t->fds;
+	size_t fd;
+	if(fds == NULL) return;
+	for(fd = 2; fd < fds->cnt; fd++)
+		file_close(fds->files[fd]);
+	free(fds->files);
+	bitmap_destroy(fds->used);
+	free(fds);
+	t->fds = NULL;
 }
 
 /* returns sema of file */
@@ -3,6 +3,7 @@
 
 #include "threads/thread.h"
 #include "filesys/off_t.h"
+#include "filesys/directory.h"
 
 struct inode;
 
@@ -14,10 +15,15 @@ struct inode *file_get_inode (struct file *);
 
 /* Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
+off_t file_read_direct (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
+off_t file_write_direct (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
 
+/* Reading directories. */
+bool file_readdir (struct file *, char name[NAME_MAX + 1]);
+
 /* Preventing writes. */
 void file_deny_write (struct file *);
 void file_allow_write (struct file *);
@@ -28,8 +34,6 @@ off_t file_tell (struct file *);
 off_t file_length (struct file *);
 
 /* file descriptor functions */
-void file_fd_init(void);
-void file_fd_done(void);
 int file_new_fd(struct file*, struct thread*);
 void file_remove_fd(int fd, struct thread*);
 struct file* file_of_fd(int fd, struct thread*);
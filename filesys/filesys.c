@@ -2,20 +2,21 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
-#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
-struct semaphore open_sema;
-struct semaphore create_sema;
-struct semaphore remove_sema;
-
 static void do_format (void);
+static bool resolve_path (const char *path, struct dir **dirp,
+                          char name[NAME_MAX + 1]);
+static bool create (const char *path, off_t initial_size, bool is_dir);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -26,17 +27,16 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
+  journal_init ();
   free_map_open ();
-
-  sema_init(&open_sema, 1);
-  sema_init(&create_sema, 1);
-  sema_init(&remove_sema, 1);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -44,8 +44,17 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
-  //file_fd_done();
   free_map_close ();
+  cache_done ();
+}
+
+/* Writes every change made to the file system so far to disk:
+   file data first, then the metadata through the journal. */
+void
+filesys_sync (void)
+{
+  cache_flush ();
+  journal_sync ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -55,19 +64,17 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
-  sema_down(&create_sema);
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
-  dir_close (dir);
-  sema_up(&create_sema);
+  return create (name, initial_size, false);
+}
 
-  return success;
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  return create (name, 0, true);
 }
 
 /* Opens the file with the given NAME.
@@ -78,30 +85,187 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  sema_down(&open_sema);
-  struct dir *dir = dir_open_root ();
+  char part[NAME_MAX + 1];
+  struct dir *dir = NULL;
   struct inode *inode = NULL;
 
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+  if (resolve_path (name, &dir, part))
+    dir_lookup (dir, part, &inode);
   dir_close (dir);
-  sema_up(&open_sema);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  sema_down(&remove_sema);
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char part[NAME_MAX + 1];
+  struct dir *dir = NULL;
+  bool success;
+
+  journal_begin ();
+  success = resolve_path (name, &dir, part) && dir_remove (dir, part);
   dir_close (dir); 
-  sema_up(&open_sema);
+  journal_end ();
+
+  return success;
+}
+
+/* Changes the running thread's working directory to NAME.
+   Returns true if successful, false if NAME does not exist or is
+   not a directory. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *cur = thread_current ();
+  char part[NAME_MAX + 1];
+  struct dir *dir = NULL;
+  struct inode *inode = NULL;
+  struct dir *cwd;
+
+  if (resolve_path (name, &dir, part))
+    dir_lookup (dir, part, &inode);
+  dir_close (dir);
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+
+  cwd = dir_open (inode);
+  if (cwd == NULL)
+    return false;
+  dir_close (cur->cwd);
+  cur->cwd = cwd;
+  return true;
+}
+
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX character from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0') 
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++; 
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Resolves PATH, absolute or relative to the running thread's
+   working directory, up to its last component.  On success,
+   returns true, stores the directory that should contain the
+   last component in *DIRP, which the caller must close, and
+   copies the last component into NAME; a PATH that names the
+   root directory yields "." in the root.  On failure returns
+   false and sets *DIRP to a null pointer. */
+static bool
+resolve_path (const char *path, struct dir **dirp, char name[NAME_MAX + 1])
+{
+  struct dir *cwd = thread_current ()->cwd;
+  struct dir *dir;
+  char next[NAME_MAX + 1];
+  int result;
+
+  *dirp = NULL;
+  if (path == NULL || *path == '\0')
+    return false;
+
+  dir = path[0] == '/' || cwd == NULL ? dir_open_root () : dir_reopen (cwd);
+  if (dir == NULL)
+    return false;
+
+  result = get_next_part (name, &path);
+  if (result == 0)
+    {
+      strlcpy (name, ".", NAME_MAX + 1);
+      *dirp = dir;
+      return true;
+    }
+
+  /* Each component but the last must name a directory. */
+  while (result > 0 && (result = get_next_part (next, &path)) > 0)
+    {
+      struct inode *inode;
+
+      if (!dir_lookup (dir, name, &inode) || !inode_is_dir (inode))
+        {
+          inode_close (inode);
+          result = -1;
+          break;
+        }
+      dir_close (dir);
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return false;
+      strlcpy (name, next, NAME_MAX + 1);
+    }
+
+  if (result < 0)
+    {
+      dir_close (dir);
+      return false;
+    }
+  *dirp = dir;
+  return true;
+}
+
+/* Creates a file, or a directory if IS_DIR is true, at PATH,
+   with INITIAL_SIZE bytes of data. */
+static bool
+create (const char *path, off_t initial_size, bool is_dir)
+{
+  block_sector_t inode_sector = 0;
+  char name[NAME_MAX + 1];
+  struct dir *dir = NULL;
+  bool created = false;
+  bool success;
+
+  journal_begin ();
+  if (resolve_path (path, &dir, name)
+      && free_map_allocate (1, &inode_sector))
+    created = (is_dir
+               ? dir_create (inode_sector, 16,
+                             inode_get_inumber (dir_get_inode (dir)))
+               : inode_create (inode_sector, initial_size, false));
+  success = created && dir_add (dir, name, inode_sector);
+  if (!success && created)
+    {
+      /* Give back the data sectors too, along with the inode
+         sector. */
+      struct inode *inode = inode_open (inode_sector);
+      inode_remove (inode);
+      inode_close (inode);
+    }
+  else if (!success && inode_sector != 0) 
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -112,8 +276,9 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
+  journal_create ();
   free_map_close ();
   printf ("done.\n");
 }
@@ -1,12 +1,37 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+
+/* The free map lives in memory.  Allocating and releasing
+   sectors only changes the in-memory copy and records which
+   sectors of the free map file are now out of date; those are
+   written out together by free_map_flush(), which runs
+   periodically and when the file system is shut down, and by
+   every journal commit.
+
+   With the journal in use, released sectors stay allocated until
+   the transactions that released them have committed: until
+   then, the metadata on disk, or in the log, may still point to
+   them, and reusing one for file data, which is written in place
+   without the journal, could overwrite it. */
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty;         /* Free map file sectors to write. */
+static struct bitmap *released;      /* Sectors to free after commit. */
+static struct lock free_map_lock;    /* Protects the above. */
+
+/* Free map bits per sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+static void mark_dirty (block_sector_t sector, size_t cnt);
 
 /* Initializes the free map. */
 void
@@ -15,38 +40,201 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                       BITS_PER_SECTOR));
+  if (dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  released = bitmap_create (bitmap_size (free_map));
+  if (released == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  lock_init (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
+    mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Returns the length of the run of free sectors that starts at
+   SECTOR, counting at most MAX of them. */
+static size_t
+free_run_length (block_sector_t sector, size_t max)
+{
+  size_t end = bitmap_scan (free_map, sector, 1, true);
+  size_t limit = bitmap_size (free_map);
+
+  if (end == BITMAP_ERROR || end > limit)
+    end = limit;
+  return end - sector < max ? end - sector : max;
+}
+
+/* Allocates up to CNT consecutive sectors, preferring to keep a
+   file contiguous, and stores the first into *SECTORP.  Returns
+   the number of sectors allocated, which is 0 only if the disk
+   is full.
+
+   If GOAL, the sector just past the caller's previous run, is
+   free, the run is extended from there.  Otherwise the smallest
+   free run that holds all CNT sectors is used, or, failing that,
+   the largest free run, so that big requests are broken into as
+   few pieces as possible without splitting large runs for small
+   requests. */
+size_t
+free_map_allocate_run (block_sector_t goal, size_t cnt,
+                       block_sector_t *sectorp)
+{
+  size_t best_len = 0, best_start = 0;
+  size_t start, len;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  if (goal != 0 && goal < bitmap_size (free_map)
+      && !bitmap_test (free_map, goal))
+    {
+      best_start = goal;
+      best_len = free_run_length (goal, cnt);
+    }
+  else
+    for (start = bitmap_scan (free_map, 0, 1, false);
+         start != BITMAP_ERROR;
+         start = bitmap_scan (free_map, start + len, 1, false))
+      {
+        len = free_run_length (start, SIZE_MAX);
+        if (best_len < cnt ? len > best_len : len >= cnt && len < best_len)
+          {
+            best_start = start;
+            best_len = len;
+          }
+        if (best_len == cnt)
+          break;
+      }
+
+  if (best_len > cnt)
+    best_len = cnt;
+  if (best_len > 0)
+    {
+      bitmap_set_multiple (free_map, best_start, best_len, true);
+      mark_dirty (best_start, best_len);
+    }
+  lock_release (&free_map_lock);
+
+  if (best_len > 0)
+    *sectorp = best_start;
+  return best_len;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, once
+   the journal has committed the transactions that ended so far
+   if it is in use, or immediately otherwise. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  ASSERT (bitmap_none (released, sector, cnt));
+  if (journal_enabled ())
+    bitmap_set_multiple (released, sector, cnt, true);
+  else
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false);
+      mark_dirty (sector, cnt);
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors released before the journal's last commit
+   available for use.  Called by the journal right after each
+   commit. */
+void
+free_map_commit_releases (void)
+{
+  size_t start, end;
+
+  lock_acquire (&free_map_lock);
+  for (start = bitmap_scan (released, 0, 1, true);
+       start != BITMAP_ERROR;
+       start = bitmap_scan (released, end, 1, true))
+    {
+      end = bitmap_scan (released, start, 1, false);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (released);
+      bitmap_set_multiple (released, start, end - start, false);
+      bitmap_set_multiple (free_map, start, end - start, false);
+      mark_dirty (start, end - start);
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Records that the bits for CNT sectors starting at SECTOR have
+   changed.  The free map lock must be held. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (cnt > 0);
+  bitmap_set_multiple (dirty, first, last - first + 1, true);
+}
+
+/* Writes the sectors of the free map file whose bits have changed
+   since they were last written, merging neighbouring sectors into
+   a single write.  With the journal in use, this is part of each
+   commit, which reserves log space for the whole free map, and
+   must not be called otherwise. */
+void
+free_map_write_dirty (void)
+{
+  size_t start, end;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (start = bitmap_scan (dirty, 0, 1, true);
+         start != BITMAP_ERROR;
+         start = bitmap_scan (dirty, end, 1, true))
+      {
+        end = bitmap_scan (dirty, start, 1, false);
+        if (end == BITMAP_ERROR)
+          end = bitmap_size (dirty);
+        if (bitmap_write_part (free_map, free_map_file,
+                               start * BLOCK_SECTOR_SIZE,
+                               (end - start) * BLOCK_SECTOR_SIZE))
+          bitmap_set_multiple (dirty, start, end - start, false);
+      }
+  lock_release (&free_map_lock);
+}
+
+/* Writes the changed sectors of the free map file.  With the
+   journal in use, runs an empty transaction instead, so that the
+   commit of its group writes them. */
+void
+free_map_flush (void)
+{
+  if (journal_enabled ())
+    {
+      journal_begin ();
+      journal_end ();
+    }
+  else
+    free_map_write_dirty ();
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -64,7 +252,14 @@ free_map_open (void)
 void
 free_map_close (void) 
 {
+  /* The first flush commits the releases still pending, the
+     second writes out the sectors they freed. */
+  free_map_flush ();
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -73,13 +268,16 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  /* Writing the file allocates its sectors, which marks their
+     bits dirty again for the next flush. */
+  bitmap_set_all (dirty, false);
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
@@ -1,24 +1,51 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of data sector pointers in an inode and in an
+   indirect block. */
+#define DIRECT_CNT 123
+#define PTRS_PER_SECTOR ((off_t) (BLOCK_SECTOR_SIZE \
+                                  / sizeof (block_sector_t)))
+
+/* Largest number of data sectors a file can have. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sectors are found through a multi-level index: the first
+   DIRECT_CNT directly, the next PTRS_PER_SECTOR through the
+   indirect block, and the rest through the doubly indirect
+   block, whose entries point to further indirect blocks.  A
+   pointer of 0 means that the sector has not been allocated,
+   since sector 0 always holds the free map inode.
+
+   Data sectors are only allocated when they are first written.
+   Until then they are holes, which read as zeros without any
+   disk I/O, so creating a file costs the same whatever its
+   initial size. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block. */
     off_t length;                       /* File size in bytes. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -32,47 +59,313 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool loading;                       /* Has anyone started reading DATA? */
+    bool loaded;                        /* Has DATA been read? */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
-	struct semaphore sema;				/* Semaphore */
+    struct lock alloc_lock;             /* Serializes allocating writes. */
+    struct dir_index *dir_index;        /* Name index, for directories. */
+	struct semaphore sema;				/* Serializes file I/O and deny-write changes */
   };
 
+static off_t read_at (struct inode *, void *, off_t size, off_t offset,
+                      bool direct);
+static off_t write_at (struct inode *, const void *, off_t size,
+                       off_t offset, bool direct);
+
+/* Allocates a sector, fills it with zeros and stores its number
+   in *SECTORP.  Returns true if successful, false if the disk is
+   full. */
+static bool
+allocate_zeroed (block_sector_t *sectorp)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns the sector that the in-memory pointer *SLOT points to.
+   If it is not allocated yet and CREATE is true, allocates it.
+   Returns 0 if there is no such sector. */
+static block_sector_t
+slot_sector (block_sector_t *slot, bool create)
+{
+  if (*slot == 0 && create && !allocate_zeroed (slot))
+    *slot = 0;
+  return *slot;
+}
+
+/* Returns the sector that entry IDX of index block INDEX points
+   to.  If it is not allocated yet and CREATE is true, allocates
+   it.  Returns 0 if there is no such sector.  Index blocks are
+   read through the buffer cache, so walking them seldom touches
+   the disk. */
+static block_sector_t
+index_sector (block_sector_t index, off_t idx, bool create)
+{
+  block_sector_t sector;
+  int ofs = idx * sizeof sector;
+
+  cache_read_at (index, &sector, ofs, sizeof sector);
+  if (sector == 0 && create && allocate_zeroed (&sector))
+    journal_write_at (index, &sector, ofs, sizeof sector);
+  return sector;
+}
+
+/* Returns the sector that holds data sector IDX of the file
+   described by DATA.  If that sector, or an index block on the
+   way to it, is not allocated yet and CREATE is true, allocates
+   it.  Returns 0 if there is no such sector. */
+static block_sector_t
+idx_to_sector (struct inode_disk *data, off_t idx, bool create)
+{
+  block_sector_t index;
+
+  if (idx < DIRECT_CNT)
+    return slot_sector (&data->direct[idx], create);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      index = slot_sector (&data->indirect, create);
+      return index != 0 ? index_sector (index, idx, create) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      index = slot_sector (&data->doubly_indirect, create);
+      if (index != 0)
+        index = index_sector (index, idx / PTRS_PER_SECTOR, create);
+      return index != 0 ? index_sector (index, idx % PTRS_PER_SECTOR,
+                                        create) : 0;
+    }
+  return 0;
+}
+
+/* Stores SECTOR as data sector IDX of DATA, allocating the
+   index blocks on the way to it as needed.  Returns false if an
+   index block could not be allocated. */
+static bool
+set_idx_sector (struct inode_disk *data, off_t idx, block_sector_t sector)
+{
+  block_sector_t index;
+
+  if (idx < DIRECT_CNT)
+    {
+      data->direct[idx] = sector;
+      return true;
+    }
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    index = slot_sector (&data->indirect, true);
+  else
+    {
+      idx -= PTRS_PER_SECTOR;
+      index = slot_sector (&data->doubly_indirect, true);
+      if (index != 0)
+        index = index_sector (index, idx / PTRS_PER_SECTOR, true);
+      idx %= PTRS_PER_SECTOR;
+    }
+  if (index == 0)
+    return false;
+  journal_write_at (index, &sector, idx * sizeof sector, sizeof sector);
+  return true;
+}
+
+/* Allocates each data sector of DATA from index FIRST up to but
+   not including index END that is still a hole, along with the
+   index blocks that lead to them, and fills the new sectors with
+   zeros in the buffer cache.  Returns true if successful, false
+   if the disk filled up or END is past the largest possible file.
+   Sectors allocated before a failure are kept.
+
+   Each run of holes is filled with as few runs of sectors as
+   possible, starting right after the sector before it when that
+   one is free, so that files stay contiguous on disk. */
+static bool
+allocate_sectors (struct inode_disk *data, off_t first, off_t end)
+{
+  off_t idx = first;
+
+  if (end > MAX_SECTORS)
+    return false;
+
+  while (idx < end)
+    {
+      static char zeros[BLOCK_SECTOR_SIZE];
+      block_sector_t start, goal;
+      off_t holes;
+      size_t cnt, i;
+
+      if (idx_to_sector (data, idx, false) != 0)
+        {
+          idx++;
+          continue;
+        }
+      for (holes = 1; idx + holes < end; holes++)
+        if (idx_to_sector (data, idx + holes, false) != 0)
+          break;
+
+      goal = idx > 0 ? idx_to_sector (data, idx - 1, false) : 0;
+      if (goal != 0)
+        goal++;
+      cnt = free_map_allocate_run (goal, holes, &start);
+      if (cnt == 0)
+        return false;
+
+      /* Zero each sector before it becomes visible, so that a
+         concurrent reader never sees what it held before. */
+      for (i = 0; i < cnt; i++)
+        {
+          cache_write (start + i, zeros);
+          if (!set_idx_sector (data, idx + i, start + i))
+            {
+              free_map_release (start + i, cnt - i);
+              return false;
+            }
+        }
+      idx += cnt;
+    }
+  return true;
+}
+
+/* Returns true if any data sector of DATA from index FIRST up to
+   but not including index END is a hole. */
+static bool
+has_hole (struct inode_disk *data, off_t first, off_t end)
+{
+  for (; first < end; first++)
+    if (idx_to_sector (data, first, false) == 0)
+      return true;
+  return false;
+}
+
+/* Releases the sectors in the index block INDEX, going LEVELS
+   further levels of index blocks down, and then INDEX itself. */
+static void
+release_index (block_sector_t index, int levels)
+{
+  block_sector_t ptrs[PTRS_PER_SECTOR];
+  off_t i;
+
+  if (index == 0)
+    return;
+  if (levels > 0)
+    {
+      cache_read (index, ptrs);
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        release_index (ptrs[i], levels - 1);
+    }
+  free_map_release (index, 1);
+}
+
+/* Releases every data and index sector of DATA. */
+static void
+release_sectors (struct inode_disk *data)
+{
+  off_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    release_index (data->direct[i], 0);
+  release_index (data->indirect, 1);
+  release_index (data->doubly_indirect, 2);
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or 0 if POS falls in a hole.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return idx_to_sector (&inode->data, pos / BLOCK_SECTOR_SIZE, false);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns true if INODE's contents are file system metadata,
+   which is the case for directories and the free map. */
+static bool
+is_metadata (const struct inode *inode)
+{
+  return inode->data.is_dir || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Returns how many whole sectors of the file described by DATA,
+   starting with the one at sector-aligned byte OFFSET, which is
+   on disk at SECTOR, lie within both the next SIZE bytes and the
+   first LENGTH bytes of the file and follow one another on disk.
+   Counts at most DIRECT_MAX of them. */
+static size_t
+direct_run (struct inode_disk *data, off_t offset, off_t size,
+            off_t length, block_sector_t sector)
+{
+  size_t cnt = 1;
+
+  while (cnt < DIRECT_MAX
+         && (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE <= size
+         && offset + (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE <= length
+         && idx_to_sector (data, offset / BLOCK_SECTOR_SIZE + cnt, false)
+            == sector + cnt)
+    cnt++;
+  return cnt;
+}
+
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  open_inodes_lock
+   protects the table and every inode's open_cnt, so that an inode
+   cannot be found in the table by one thread while another closes
+   it for the last time, and its loading and loaded flags.  An
+   inode goes into the table before its contents are read, which
+   happens without the lock held. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+static struct condition inode_loaded;   /* Some inode's DATA was read. */
+
+/* Returns a hash value for the inode containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if the inode containing A has a lower sector
+   number than the one containing B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  IS_DIR tells whether it is a directory.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *inode_disk = NULL;
   bool success = false;
@@ -83,27 +376,17 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *inode_disk == BLOCK_SECTOR_SIZE);
 
+  /* The data sectors are all holes to begin with. */
   inode_disk = calloc (1, sizeof *inode_disk);
-  if (inode_disk != NULL)
+  if (inode_disk != NULL && bytes_to_sectors (length) <= MAX_SECTORS)
     {
-      size_t sectors = bytes_to_sectors (length);
       inode_disk->length = length;
+      inode_disk->is_dir = is_dir;
       inode_disk->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &inode_disk->start)) 
-        {
-          block_write (fs_device, sector, inode_disk);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, inode_disk->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (inode_disk);
+      journal_write (sector, inode_disk);
+      success = true; 
     }
+  free (inode_disk);
   return success;
 }
 
@@ -113,34 +396,80 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  return inode_load (inode_reserve (sector));
+}
+
+/* Returns a reference to the `struct inode' for SECTOR, like
+   inode_open(), but without reading the disk: the inode must be
+   passed to inode_load() before anything else is done with it.
+   Lets a caller take the reference under a lock that should not
+   be held across I/O.  Returns a null pointer if memory
+   allocation fails. */
+struct inode *
+inode_reserve (block_sector_t sector)
+{
+  struct hash_elem *e;
   struct inode *inode;
+  struct inode key;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  Its contents are read by inode_load(). */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->loading = false;
+  inode->loaded = false;
+  lock_init (&inode->alloc_lock);
+  inode->dir_index = NULL;
   sema_init(&inode->sema, 1);
-  block_read (fs_device, inode->sector, &inode->data);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  return inode;
+}
+
+/* Reads INODE, returned by inode_reserve(), from disk unless
+   that has been done already, waiting if another thread is doing
+   it.  Returns INODE, which may be a null pointer. */
+struct inode *
+inode_load (struct inode *inode)
+{
+  if (inode == NULL)
+    return NULL;
+
+  lock_acquire (&open_inodes_lock);
+  if (!inode->loading)
+    {
+      inode->loading = true;
+      lock_release (&open_inodes_lock);
+      cache_read (inode->sector, &inode->data);
+      lock_acquire (&open_inodes_lock);
+      inode->loaded = true;
+      cond_broadcast (&inode_loaded, &open_inodes_lock);
+    }
+  else
+    while (!inode->loaded)
+      cond_wait (&inode_loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -149,7 +478,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -171,22 +504,26 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
+      /* Remove from inode table and release lock. */
+      hash_delete (&open_inodes, &inode->elem);
+      lock_release (&open_inodes_lock);
 	  sema_down(&inode->sema);
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_sectors (&inode->data);
         }
+      dir_index_destroy (inode->dir_index);
 	  sema_up(&inode->sema);
       free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -202,11 +539,31 @@ inode_remove (struct inode *inode)
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  return read_at (inode, buffer, size, offset, false);
+}
+
+/* Like inode_read_at(), but whole sectors go from the disk
+   straight into BUFFER instead of through the buffer cache.
+   BUFFER must stay in memory until this returns; the system call
+   layer uses this for the pinned frame of a user page. */
+off_t
+inode_read_direct (struct inode *inode, void *buffer, off_t size,
+                   off_t offset)
+{
+  return read_at (inode, buffer, size, offset, true);
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, moving whole sectors straight from the disk if DIRECT
+   is true.  Returns the number of bytes read. */
+static off_t
+read_at (struct inode *inode, void *buffer_, off_t size, off_t offset,
+         bool direct)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
@@ -224,59 +581,100 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+      /* Read whole sectors directly, or copy out of the buffer
+         cache, or zeros for a hole. */
+      if (direct && sector_idx != 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          size_t cnt = direct_run (&inode->data, offset, size,
+                                   inode_length (inode), sector_idx);
+          cache_read_direct (sector_idx, buffer + bytes_read, cnt);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
+      else if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   A write past end of file extends the inode, leaving a hole
+   between the old end and OFFSET.  The new length only becomes
+   visible once the data has been written, so readers never see
+   the extension before its contents. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset) 
+{
+  return write_at (inode, buffer, size, offset, false);
+}
+
+/* Like inode_write_at(), but whole sectors of file data go from
+   BUFFER straight to disk instead of through the buffer cache.
+   BUFFER must stay in memory until this returns; the system call
+   layer uses this for the pinned frame of a user page. */
+off_t
+inode_write_direct (struct inode *inode, const void *buffer, off_t size,
+                    off_t offset)
+{
+  return write_at (inode, buffer, size, offset, true);
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   moving whole sectors of file data straight to disk if DIRECT
+   is true.  Returns the number of bytes written. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
+          off_t offset, bool direct)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t length = inode_length (inode);
+  off_t first = offset / BLOCK_SECTOR_SIZE;
+  off_t end = bytes_to_sectors (offset + size);
+  bool alloc;
 
-  if (inode->deny_write_cnt)
+  if (inode->deny_write_cnt || size <= 0)
     return 0;
 
+  alloc = offset + size > length || has_hole (&inode->data, first, end);
+  if (alloc)
+    {
+      /* Fill the holes being written up front.  If the disk fills
+         up, write only as far as the allocation got. */
+      lock_acquire (&inode->alloc_lock);
+      if (!allocate_sectors (&inode->data, first, end))
+        {
+          off_t i = first;
+          while (i < end && idx_to_sector (&inode->data, i, false) != 0)
+            i++;
+          if (offset + size > i * BLOCK_SECTOR_SIZE)
+            size = i * BLOCK_SECTOR_SIZE > offset
+                   ? i * BLOCK_SECTOR_SIZE - offset : 0;
+        }
+      length = inode_length (inode);
+      if (size > 0 && offset + size > length)
+        length = offset + size;
+    }
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -284,50 +682,86 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       int chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
+      sector_idx = idx_to_sector (&inode->data, offset / BLOCK_SECTOR_SIZE,
+                                  false);
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Copy into the buffer cache, which writes it back later,
+         or write whole sectors directly.  Directory and free map
+         contents are metadata, so they go through the journal. */
+      if (direct && !is_metadata (inode) && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          size_t cnt = direct_run (&inode->data, offset, size, length,
+                                   sector_idx);
+          cache_write_direct (sector_idx, buffer + bytes_written, cnt);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
+      else if (is_metadata (inode))
+        journal_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                          chunk_size);
+      else
+        cache_write_file (sector_idx, inode->sector, buffer + bytes_written,
+                          sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  if (alloc)
+    {
+      if (length > inode->data.length)
+        inode->data.length = length;
+      journal_write (inode->sector, &inode->data);
+      lock_release (&inode->alloc_lock);
+    }
 
   return bytes_written;
 }
 
+/* Starts reading the sectors that hold bytes OFFSET through
+   OFFSET + SIZE of INODE into the buffer cache in the background,
+   so that a later inode_read_at() of them finds them there. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  block_sector_t sectors[INODE_READAHEAD_MAX];
+  size_t cnt = 0;
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  offset = offset / BLOCK_SECTOR_SIZE * BLOCK_SECTOR_SIZE;
+  for (; offset < end && cnt < INODE_READAHEAD_MAX;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0 && sector != (block_sector_t) -1)
+        sectors[cnt++] = sector;
+    }
+  cache_readahead (sectors, cnt);
+}
+
+/* Writes INODE's dirty data sectors back to disk, and then waits
+   for its metadata, along with everything else the journal
+   holds, to be committed. */
+void
+inode_sync (struct inode *inode)
+{
+  if (!is_metadata (inode))
+    cache_sync_file (inode->sector);
+  journal_sync ();
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  sema_down (&inode->sema);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  sema_up (&inode->sema);
 }
 
 /* Re-enables writes to INODE.
@@ -336,9 +770,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  sema_down (&inode->sema);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  sema_up (&inode->sema);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -348,6 +784,35 @@ inode_length (const struct inode *inode)
   return inode->data.length;
 }
 
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns the number of openers of INODE. */
+int
+inode_open_cnt (const struct inode *inode)
+{
+  return inode->open_cnt;
+}
+
+/* Returns the address of INODE's directory name index pointer,
+   which belongs to directory.c. */
+struct dir_index **
+inode_dir_index (struct inode *inode)
+{
+  return &inode->dir_index;
+}
+
 /* Returns semaphore of inode */
 struct semaphore *inode_sema(struct inode *inode) {
 	return &inode->sema;
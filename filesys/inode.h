@@ -7,19 +7,39 @@
 #include "threads/synch.h"
 
 struct bitmap;
+struct dir_index;
+
+/* Most sectors that one inode_readahead() call reads ahead. */
+#define INODE_READAHEAD_MAX 16
+
+/* Most sectors that inode_read_direct() or inode_write_direct()
+   moves between the disk and the caller's buffer in one
+   request. */
+#define DIRECT_MAX 64
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+bool inode_create (block_sector_t, off_t, bool is_dir);
 struct inode *inode_open (block_sector_t);
+struct inode *inode_reserve (block_sector_t);
+struct inode *inode_load (struct inode *);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_direct (struct inode *, void *, off_t size, off_t offset);
+off_t inode_write_direct (struct inode *, const void *, off_t size,
+                          off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
+void inode_sync (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_is_dir (const struct inode *);
+bool inode_is_removed (const struct inode *);
+int inode_open_cnt (const struct inode *);
+struct dir_index **inode_dir_index (struct inode *);
 
 /* for synchronization (protect critical section) */
 struct semaphore *inode_sema(struct inode*);
@@ -0,0 +1,324 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Metadata journal.
+
+   Operations that change file system metadata (inodes, index
+   blocks, directories and the free map) run as transactions
+   between journal_begin() and journal_end(), and make those
+   changes with journal_write() or journal_write_at().  The
+   buffer cache holds on to the sectors they change, without
+   writing them back, until the transaction commits.
+
+   Transactions commit in groups: the ones that overlap in time
+   are committed together when the last of them ends, and new
+   ones wait until that is done.  A commit puts the free map's
+   pending changes into the cache, copies every changed sector
+   into the log with one sequential write, and then writes the
+   header that lists where they belong, which is the commit
+   point.  Only then are the sectors written in place, after
+   which the header is cleared and the sectors that the group
+   released become free for reuse.  If the system stops anywhere
+   along the way, journal_init() at the next boot either finds no
+   committed log or copies all of it into place again, so a group
+   of operations takes effect entirely or not at all.
+
+   File data is not journaled, so after a crash the sectors most
+   recently allocated to a file may hold their old contents. */
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* On-disk journal header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t cnt;                       /* Sectors in the log, 0 if none. */
+    block_sector_t sectors[JOURNAL_LOG_SIZE];   /* Where each belongs. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8 - 4 * JOURNAL_LOG_SIZE];
+  };
+
+/* Most sectors a single transaction may add to the log, not
+   counting the free map, which is reserved for separately and
+   written only by commits.  journal_write_at() panics if a
+   transaction goes over; file.c sizes its write chunks to stay
+   under it. */
+#define MAX_OP_SECTORS 10
+
+static bool enabled;                    /* Is the journal in use? */
+static size_t free_map_sectors;         /* Sectors in the free map file. */
+static struct journal_header header;    /* Header, as last written. */
+static uint8_t *log_buf;                /* Log contents, for writing. */
+
+/* Protects the members below. */
+static struct lock journal_lock;
+static struct condition journal_cond;   /* Commit done or space freed. */
+static int outstanding;                 /* Transactions running. */
+static bool committing;                 /* Commit in progress? */
+static size_t log_cnt;                  /* Sectors changed so far. */
+static unsigned commit_cnt;             /* Commits completed. */
+static block_sector_t log_sectors[JOURNAL_LOG_SIZE];
+
+static void replay (void);
+static void commit (void);
+
+/* Writes an empty journal to a newly formatted file system. */
+void
+journal_create (void)
+{
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Initializes the journal module, first bringing the file system
+   up to date with whatever was committed before the last crash.
+   Must be called before anything is read from the file system.
+   A file system formatted without a journal is used as is, with
+   journaling disabled. */
+void
+journal_init (void)
+{
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC)
+    {
+      printf ("filesys: no journal, metadata is not crash-safe\n");
+      return;
+    }
+  free_map_sectors = DIV_ROUND_UP (block_size (fs_device),
+                                   BLOCK_SECTOR_SIZE * 8);
+  if (free_map_sectors + MAX_OP_SECTORS > JOURNAL_LOG_SIZE)
+    {
+      printf ("filesys: free map too large for journal, "
+              "metadata is not crash-safe\n");
+      return;
+    }
+
+  log_buf = palloc_get_multiple (0, DIV_ROUND_UP (JOURNAL_LOG_SIZE
+                                                  * BLOCK_SECTOR_SIZE,
+                                                  PGSIZE));
+  if (log_buf == NULL)
+    PANIC ("journal: out of memory");
+  if (header.cnt > 0)
+    replay ();
+  enabled = true;
+}
+
+/* Returns true if the journal is in use. */
+bool
+journal_enabled (void)
+{
+  return enabled;
+}
+
+/* Copies the committed log into place and clears the header. */
+static void
+replay (void)
+{
+  struct block_segment seg = { log_buf, header.cnt };
+  struct block_request req = { JOURNAL_SECTOR + 1, &seg, 1 };
+  size_t i;
+
+  if (header.cnt > JOURNAL_LOG_SIZE)
+    PANIC ("journal: corrupt header");
+  block_read_multi (fs_device, &req);
+  for (i = 0; i < header.cnt; i++)
+    block_write (fs_device, header.sectors[i],
+                 log_buf + i * BLOCK_SECTOR_SIZE);
+  printf ("filesys: replayed %"PRIu32" sectors from journal\n", header.cnt);
+
+  header.cnt = 0;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Begins a transaction in the running thread.  Waits while a
+   commit is in progress or the log has no room for another
+   transaction's worth of changes.  Transactions nest: only the
+   outermost begin and end count. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!enabled || t->journal_depth++ > 0)
+    return;
+
+  t->journal_logged = 0;
+  lock_acquire (&journal_lock);
+  while (committing
+         || (log_cnt + (outstanding + 1) * MAX_OP_SECTORS
+             + free_map_sectors > JOURNAL_LOG_SIZE))
+    cond_wait (&journal_cond, &journal_lock);
+  outstanding++;
+  lock_release (&journal_lock);
+}
+
+/* Ends the running thread's transaction.  If it was the last
+   one running, commits the whole group before returning. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+  bool do_commit = false;
+
+  if (!enabled || --t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  ASSERT (outstanding > 0);
+  if (--outstanding == 0)
+    {
+      committing = true;
+      do_commit = true;
+    }
+  else
+    cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (do_commit)
+    {
+      /* Changes made while committing belong to this group. */
+      t->journal_depth++;
+      commit ();
+      t->journal_depth--;
+
+      /* Nothing committed refers to the sectors the group freed
+         any more. */
+      free_map_commit_releases ();
+
+      lock_acquire (&journal_lock);
+      log_cnt = 0;
+      commit_cnt++;
+      committing = false;
+      cond_broadcast (&journal_cond, &journal_lock);
+      lock_release (&journal_lock);
+    }
+}
+
+/* Waits until the changes of every transaction that has ended,
+   and the free map's pending changes, are committed to disk.
+   Without a journal, writes back the whole cache instead.  Must
+   not be called inside a transaction. */
+void
+journal_sync (void)
+{
+  unsigned start;
+
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  if (!enabled)
+    {
+      free_map_flush ();
+      cache_flush ();
+      return;
+    }
+
+  /* Join the running group with an empty transaction, then wait
+     for the group to commit. */
+  journal_begin ();
+  lock_acquire (&journal_lock);
+  start = commit_cnt;
+  lock_release (&journal_lock);
+  journal_end ();
+
+  lock_acquire (&journal_lock);
+  while (commit_cnt == start)
+    cond_wait (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to metadata sector
+   SECTOR as part of the running transaction. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to metadata sector SECTOR,
+   starting OFS bytes into it, as part of the running
+   transaction, or of a transaction of its own if there is
+   none. */
+void
+journal_write_at (block_sector_t sector, const void *buffer,
+                  int ofs, int size)
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  if (!enabled)
+    {
+      cache_write_at (sector, buffer, ofs, size);
+      return;
+    }
+
+  journal_begin ();
+  cache_write_logged (sector, buffer, ofs, size);
+  lock_acquire (&journal_lock);
+  for (i = 0; i < log_cnt; i++)
+    if (log_sectors[i] == sector)
+      break;
+  if (i == log_cnt)
+    {
+      /* Commits write only the free map, whose space is reserved
+         apart from the transactions'. */
+      if (!committing && ++t->journal_logged > MAX_OP_SECTORS)
+        PANIC ("journal: transaction changed more than %d sectors",
+               MAX_OP_SECTORS);
+      ASSERT (log_cnt < JOURNAL_LOG_SIZE);
+      log_sectors[log_cnt++] = sector;
+    }
+  lock_release (&journal_lock);
+  journal_end ();
+}
+
+/* Commits the changes of the transactions that just ended.
+   No other transaction can run meanwhile. */
+static void
+commit (void)
+{
+  struct block_segment seg;
+  struct block_request req;
+  size_t i;
+
+  free_map_write_dirty ();
+  if (log_cnt == 0)
+    return;
+
+  /* Write the log. */
+  for (i = 0; i < log_cnt; i++)
+    cache_read (log_sectors[i], log_buf + i * BLOCK_SECTOR_SIZE);
+  seg.buffer = log_buf;
+  seg.cnt = log_cnt;
+  req.sector = JOURNAL_SECTOR + 1;
+  req.segs = &seg;
+  req.seg_cnt = 1;
+  block_write_multi (fs_device, &req);
+
+  /* Commit. */
+  header.cnt = log_cnt;
+  memcpy (header.sectors, log_sectors, log_cnt * sizeof *log_sectors);
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+
+  /* Write the sectors in place, then forget the log. */
+  cache_install ();
+  header.cnt = 0;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
@@ -0,0 +1,22 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Sectors reserved for the journal, starting at JOURNAL_SECTOR:
+   a header followed by the log. */
+#define JOURNAL_LOG_SIZE 48
+#define JOURNAL_SECTORS (1 + JOURNAL_LOG_SIZE)
+
+void journal_create (void);
+void journal_init (void);
+bool journal_enabled (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_sync (void);
+void journal_write (block_sector_t, const void *);
+void journal_write_at (block_sector_t, const void *, int ofs, int size);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,37 @@
+#ifndef __LIB_BLOCK_STATS_H
+#define __LIB_BLOCK_STATS_H
+
+#include <stdint.h>
+
+/* I/O statistics for one block device, as kept by the kernel's
+   block layer and returned by the blockstats system call. */
+
+/* Number of latency histogram buckets.  Bucket 0 counts requests
+   that completed in under 2 us, bucket I (0 < I < last) those
+   that took at least 2**I us but under 2**(I+1) us, and the last
+   bucket everything slower than that. */
+#define BLOCK_LATENCY_BUCKETS 20
+
+/* Statistics for requests in one direction. */
+struct block_dir_stats
+  {
+    uint64_t requests;          /* Requests submitted and completed. */
+    uint64_t transfers;         /* Driver commands, after merging. */
+    uint64_t sequential;        /* Transfers that began at the sector
+                                   after the previous transfer. */
+    uint64_t bytes;             /* Bytes transferred. */
+    uint64_t wait_ns;           /* Total time requests spent queued. */
+    uint64_t latency_ns;        /* Total time from submit to completion. */
+    uint32_t latency[BLOCK_LATENCY_BUCKETS];    /* Latency histogram. */
+  };
+
+/* Statistics for a block device. */
+struct block_stats
+  {
+    char name[16];              /* Device name, e.g. "hd0:1". */
+    char type[16];              /* Type name, e.g. "filesys". */
+    struct block_dir_stats read;
+    struct block_dir_stats write;
+  };
+
+#endif /* lib/block-stats.h */
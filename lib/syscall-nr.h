@@ -32,7 +32,12 @@ enum
 
 	/* OS Project #2-1. Pintos User Program */
 	SYS_FIBONACCI,				/* Get Fibonacci */
-	SYS_SUM4INT					/* Get sum of four integers */
+	SYS_SUM4INT,				/* Get sum of four integers */
+
+	SYS_MONOTONIC_NS,			/* Get nanoseconds since boot */
+	SYS_BLOCKSTATS,				/* Get I/O statistics of a block device */
+	SYS_FSYNC,					/* Write a file's changes to disk */
+	SYS_SYNC					/* Write all file system changes to disk */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -209,3 +209,21 @@ int fibonacci(int n) {
 int sum4int(int a, int b, int c, int d) {
 	return syscall4(SYS_SUM4INT, a, b, c, d);
 }
+
+int64_t monotonic_ns(void) {
+	int64_t ns;
+	syscall1(SYS_MONOTONIC_NS, &ns);
+	return ns;
+}
+
+bool blockstats(unsigned idx, struct block_stats *stats) {
+	return syscall2(SYS_BLOCKSTATS, idx, stats);
+}
+
+bool fsync(int fd) {
+	return syscall1(SYS_FSYNC, fd);
+}
+
+void sync(void) {
+	syscall0(SYS_SYNC);
+}
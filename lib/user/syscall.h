@@ -2,7 +2,9 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
+#include <block-stats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -49,4 +51,14 @@ int inumber (int fd);
 int fibonacci(int n);
 int sum4int(int a, int b, int c, int d);
 
+/* Monotonic clock, in nanoseconds since boot */
+int64_t monotonic_ns(void);
+
+/* I/O statistics of the IDX'th block device */
+bool blockstats(unsigned idx, struct block_stats *);
+
+/* Write changes to disk, for one file or for all of them */
+bool fsync(int fd);
+void sync(void);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,65 @@
+/* Child process for syn-create.
+   Repeatedly creates, opens, writes, closes and removes a file
+   of its own in the root directory and another in a directory of
+   its own, checking that each step succeeds, while its siblings
+   do the same.  In between, races its siblings to create, open
+   and remove a file that they all share, where any step may fail
+   but none may hang or crash. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-create.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-syn-create";
+
+/* Creates, opens, writes, closes and removes NAME, and then
+   checks that NAME is gone. */
+static void
+create_open_remove (const char *name, char byte) 
+{
+  int fd;
+
+  CHECK (create (name, 0), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  CHECK (write (fd, &byte, 1) == 1, "write \"%s\"", name);
+  close (fd);
+  CHECK (remove (name), "remove \"%s\"", name);
+  CHECK (open (name) == -1, "open \"%s\" after remove (must fail)", name);
+}
+
+int
+main (int argc, const char *argv[]) 
+{
+  char dir_name[16], file_name[16], sub_name[32];
+  int child_idx;
+  int i;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  snprintf (dir_name, sizeof dir_name, "dir%d", child_idx);
+  snprintf (file_name, sizeof file_name, "file%d", child_idx);
+  snprintf (sub_name, sizeof sub_name, "%s/file", dir_name);
+
+  CHECK (mkdir (dir_name), "mkdir \"%s\"", dir_name);
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      int fd;
+
+      create_open_remove (file_name, child_idx);
+      create_open_remove (sub_name, child_idx);
+
+      create (shared_name, 0);
+      fd = open (shared_name);
+      if (fd > 1)
+        close (fd);
+      remove (shared_name);
+    }
+  CHECK (remove (dir_name), "remove \"%s\"", dir_name);
+
+  return child_idx;
+}
@@ -0,0 +1,14 @@
+/* Tries to fsync an invalid fd, which must terminate the process
+   with exit code -1. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  msg ("fsync(1234)");
+  fsync (1234);
+  fail ("should have exited with -1");
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fsync-bad-fd) begin
+(fsync-bad-fd) fsync(1234)
+fsync-bad-fd: exit(-1)
+EOF
+pass;
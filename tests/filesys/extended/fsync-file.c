@@ -0,0 +1,28 @@
+/* Writes a file, has fsync() write it to disk and then sync()
+   write everything else, and verifies its contents.  The
+   persistence check then finds it intact on disk. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[8143];
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("testfile", 0), "create \"testfile\"");
+  CHECK ((fd = open ("testfile")) > 1, "open \"testfile\"");
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"testfile\"");
+  CHECK (fsync (fd), "fsync \"testfile\"");
+  msg ("sync");
+  sync ();
+  msg ("close \"testfile\"");
+  close (fd);
+  check_file ("testfile", buf, sizeof buf);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync-file) begin
+(fsync-file) create "testfile"
+(fsync-file) open "testfile"
+(fsync-file) write "testfile"
+(fsync-file) fsync "testfile"
+(fsync-file) sync
+(fsync-file) close "testfile"
+(fsync-file) open "testfile" for verification
+(fsync-file) verified contents of "testfile"
+(fsync-file) close "testfile"
+(fsync-file) end
+EOF
+pass;
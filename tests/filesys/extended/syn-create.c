@@ -0,0 +1,23 @@
+/* Spawns several subprocesses that create, open and remove
+   files at the same time, some in the root directory, some in
+   directories of their own, and some under a name they all
+   fight over. */
+
+#include <syscall.h>
+#include "tests/filesys/extended/syn-create.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+
+  exec_children ("child-syn-create", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  /* The last child to create the shared file may have lost the
+     race to remove it. */
+  remove (shared_name);
+  CHECK (open (shared_name) == -1, "open \"%s\" (must fail)", shared_name);
+}
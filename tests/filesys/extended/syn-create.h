@@ -0,0 +1,8 @@
+#ifndef TESTS_FILESYS_EXTENDED_SYN_CREATE_H
+#define TESTS_FILESYS_EXTENDED_SYN_CREATE_H
+
+#define CHILD_CNT 4
+#define ITER_CNT 20
+static const char shared_name[] = "shared";
+
+#endif /* tests/filesys/extended/syn-create.h */
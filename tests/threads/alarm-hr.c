@@ -0,0 +1,73 @@
+/* Checks that timer_ns() never runs backward, and that sleeps
+   shorter than a timer tick, which use high-resolution timers,
+   last at least as long as asked but end before the next tick.
+   Repeats the sleeps right after the CPU has been idle, when the
+   timer may still be in its idle countdown. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static void check_monotonic (void);
+static void check_sleeps (const char *when);
+
+void
+test_alarm_hr (void) 
+{
+  check_monotonic ();
+  check_sleeps ("while busy");
+
+  timer_sleep (5);
+  check_sleeps ("after idle");
+
+  pass ();
+}
+
+/* Reads the clock many times, failing if it ever goes back. */
+static void
+check_monotonic (void)
+{
+  int64_t prev = timer_ns ();
+  int i;
+
+  for (i = 0; i < 100000; i++)
+    {
+      int64_t now = timer_ns ();
+      if (now < prev)
+        fail ("timer_ns() went from %lld to %lld", prev, now);
+      prev = now;
+    }
+  msg ("timer_ns() is monotonic");
+}
+
+/* Sleeps for a few lengths shorter than a tick, each starting
+   just after a tick edge. */
+static void
+check_sleeps (const char *when)
+{
+  static const int64_t lengths_us[] = { 50, 200, 1000, 5000 };
+  size_t i;
+
+  for (i = 0; i < sizeof lengths_us / sizeof *lengths_us; i++)
+    {
+      int64_t us = lengths_us[i];
+      int64_t start_tick, start, elapsed;
+
+      start_tick = timer_ticks ();
+      while (timer_ticks () == start_tick)
+        continue;
+      start_tick = timer_ticks ();
+
+      start = timer_ns ();
+      timer_usleep (us);
+      elapsed = timer_ns () - start;
+
+      if (elapsed < us * 1000)
+        fail ("%lld us sleep %s took only %lld ns", us, when, elapsed);
+      if (timer_ticks () - start_tick > 1)
+        fail ("%lld us sleep %s took %lld ticks", us, when,
+              timer_ticks () - start_tick);
+    }
+  msg ("short sleeps %s ok", when);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-hr) begin
+(alarm-hr) timer_ns() is monotonic
+(alarm-hr) short sleeps while busy ok
+(alarm-hr) short sleeps after idle ok
+(alarm-hr) PASS
+(alarm-hr) end
+EOF
+pass;
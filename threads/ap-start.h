@@ -0,0 +1,23 @@
+#ifndef THREADS_AP_START_H
+#define THREADS_AP_START_H
+
+/* Physical address that the application processor startup code
+   is copied to.  Must be page-aligned, in the first megabyte of
+   memory, and clear of the loader, the initial thread's stack
+   page at 0xe000, and the temporary page tables that start.S
+   builds at 0xf000. */
+#define AP_START_BASE 0x8000
+
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+/* Startup code, from ap-start.S, which runs from a copy at
+   AP_START_BASE. */
+extern char ap_start[], ap_start_end[];
+
+/* Variables in the startup code, filled in in the copy. */
+extern uint32_t ap_start_cr3;   /* Physical address of page directory. */
+extern uint32_t ap_start_esp;   /* Initial stack pointer. */
+#endif
+
+#endif /* threads/ap-start.h */
@@ -0,0 +1,478 @@
+#include "threads/cpu.h"
+#include <debug.h>
+#include <packed.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/ap-start.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/lapic.h"
+#include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#endif
+
+/* State for each CPU.  Only the first cpu_cnt entries are in
+   use; cpus[0] is the bootstrap processor (BSP), the one that
+   booted the kernel, and the others are application processors
+   (APs). */
+struct cpu cpus[CPU_MAX];
+
+/* Number of entries in use in cpus[]. */
+int cpu_cnt;
+
+/* -smp: Maximum number of CPUs to use. */
+int cpu_limit = CPU_MAX;
+
+/* The kernel lock.
+
+   The kernel was written for a single CPU, with turning
+   interrupts off as its only way to keep other code out of a
+   critical section.  Rather than giving every shared structure
+   its own lock, all CPUs share the kernel through this one: only
+   the CPU holding it runs kernel code, so that turning interrupts
+   off on that CPU still excludes everyone else.  The other CPUs
+   run user programs meanwhile, which is where independent
+   processes gain from having more than one CPU.
+
+   The lock belongs to a CPU, not to a thread.  A CPU keeps it
+   across thread switches and only releases it on the way out of
+   the kernel: when an interrupt returns to user mode (see
+   intr_handler()), when a new process starts (see
+   start_process()), and while the idle thread halts.  It is
+   always taken and released with interrupts off. */
+static struct spinlock kernel_lock;
+
+/* Interprocessor interrupts. */
+#define IPI_RESCHEDULE 0xf1     /* Look for a thread to run. */
+#define IPI_TLB_FLUSH 0xf2      /* Flush the TLB. */
+
+/* MP floating pointer structure.  Refer to the Intel
+   MultiProcessor Specification, chapter 4. */
+struct mp_fp
+  {
+    char signature[4];          /* "_MP_". */
+    uint32_t config;            /* Physical address of struct mp_config. */
+    uint8_t length;             /* Length in 16-byte units. */
+    uint8_t revision;           /* Specification revision. */
+    uint8_t checksum;           /* Makes all bytes sum to 0. */
+    uint8_t features[5];        /* Feature bytes. */
+  }
+PACKED;
+
+/* MP configuration table header, followed by its entries. */
+struct mp_config
+  {
+    char signature[4];          /* "PCMP". */
+    uint16_t length;            /* Length of header and entries. */
+    uint8_t revision;           /* Specification revision. */
+    uint8_t checksum;           /* Makes all bytes sum to 0. */
+    char oem[20];               /* OEM and product ID. */
+    uint32_t oem_table;         /* Physical address of OEM table. */
+    uint16_t oem_length;        /* Size of OEM table. */
+    uint16_t entry_cnt;         /* Number of entries. */
+    uint32_t lapic;             /* Physical address of local APICs. */
+    uint16_t ext_length;        /* Length of extended entries. */
+    uint8_t ext_checksum;       /* Checksum of extended entries. */
+    uint8_t reserved;
+  }
+PACKED;
+
+/* MP configuration table processor entry.  All other kinds of
+   entries are 8 bytes long. */
+#define MP_PROC 0               /* Entry type. */
+#define MP_PROC_ENABLED 0x01    /* Flag: processor is usable. */
+#define MP_PROC_BSP 0x02        /* Flag: bootstrap processor. */
+struct mp_proc
+  {
+    uint8_t type;               /* MP_PROC. */
+    uint8_t apic_id;            /* Local APIC ID. */
+    uint8_t apic_version;       /* Local APIC version. */
+    uint8_t flags;              /* MP_PROC_* flags. */
+    uint32_t signature;         /* CPU signature. */
+    uint32_t features;          /* CPU feature flags. */
+    uint32_t reserved[2];
+  }
+PACKED;
+
+static struct mp_config *mp_find_config (void);
+static struct mp_fp *mp_search (uintptr_t paddr, size_t size);
+static bool mp_checksum_ok (const void *, size_t size);
+static bool start_ap (struct cpu *, uint32_t *pd);
+static void flush_tlb (struct cpu *);
+static intr_handler_func reschedule_interrupt;
+static intr_handler_func tlb_flush_interrupt;
+
+/* Initializes the bootstrap processor's state, which makes it
+   the only CPU online, and takes the kernel lock for it.
+   Interrupts must be off. */
+void
+cpu_init (void)
+{
+  struct cpu *c = &cpus[0];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  c->id = 0;
+  c->online = true;
+  list_init (&c->ready_list);
+  cpu_cnt = 1;
+
+  spinlock_init (&kernel_lock);
+  cpu_kernel_lock ();
+}
+
+/* Starts every application processor listed in the BIOS's MP
+   configuration table, up to the -smp limit.  Does nothing on a
+   uniprocessor, which keeps using the PICs alone.  Must be
+   called before any process is created, with interrupts on. */
+void
+cpu_start_aps (void)
+{
+  struct mp_config *config;
+  uint8_t *p, *end;
+  uint8_t *start_code;
+  uint32_t *pd;
+  int ap_cnt = 0;
+  int started = 1;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  config = mp_find_config ();
+  if (config == NULL || cpu_limit < 2)
+    return;
+  end = (uint8_t *) config + config->length;
+  for (p = (uint8_t *) (config + 1); p < end;
+       p += *p == MP_PROC ? sizeof (struct mp_proc) : 8)
+    {
+      struct mp_proc *proc = (struct mp_proc *) p;
+      if (proc->type == MP_PROC && (proc->flags & MP_PROC_ENABLED)
+          && !(proc->flags & MP_PROC_BSP))
+        ap_cnt++;
+    }
+  if (ap_cnt == 0)
+    return;
+
+  lapic_init (config->lapic);
+  cpus[0].apic_id = lapic_id ();
+  intr_register_ext (IPI_RESCHEDULE, reschedule_interrupt,
+                     "Reschedule IPI");
+  intr_register_unlocked (IPI_TLB_FLUSH, tlb_flush_interrupt,
+                          "TLB Flush IPI");
+
+  /* The APs turn on paging while running from the low page that
+     the startup code is copied to, so they start out with a copy
+     of the kernel page directory that also maps the first 4 MB of
+     physical memory at virtual address 0. */
+  pd = palloc_get_page (PAL_ASSERT);
+  memcpy (pd, init_page_dir, PGSIZE);
+  pd[0] = init_page_dir[pd_no (PHYS_BASE)];
+  start_code = ptov (AP_START_BASE);
+  memcpy (start_code, ap_start, ap_start_end - ap_start);
+
+  for (p = (uint8_t *) (config + 1); p < end;
+       p += *p == MP_PROC ? sizeof (struct mp_proc) : 8)
+    {
+      struct mp_proc *proc = (struct mp_proc *) p;
+      struct cpu *c;
+
+      if (proc->type != MP_PROC || !(proc->flags & MP_PROC_ENABLED)
+          || proc->apic_id == cpus[0].apic_id)
+        continue;
+      if (cpu_cnt >= cpu_limit || cpu_cnt >= CPU_MAX)
+        break;
+
+      c = &cpus[cpu_cnt];
+      c->id = cpu_cnt;
+      c->apic_id = proc->apic_id;
+      list_init (&c->ready_list);
+      cpu_cnt++;
+      if (!start_ap (c, pd))
+        {
+          /* It might still come up later and use the startup
+             code, so leave that alone from now on. */
+          printf ("cpu%d (APIC ID %d) did not start.\n",
+                  c->id, c->apic_id);
+          pd = NULL;
+          break;
+        }
+      started++;
+    }
+
+  if (pd != NULL)
+    palloc_free_page (pd);
+  printf ("%d CPUs started.\n", started);
+}
+
+/* Starts application processor C, running on page directory PD
+   until it switches to init_page_dir, and returns true once it
+   has left the startup code, or false if it does not within
+   100 ms. */
+static bool
+start_ap (struct cpu *c, uint32_t *pd)
+{
+  uint8_t *start_code = ptov (AP_START_BASE);
+  struct thread *idle;
+  int ms;
+
+  idle = thread_create_idle (c);
+  if (idle == NULL)
+    return false;
+
+  /* Fill in the copy of the startup code's variables. */
+  *(uint32_t *) (start_code + ((char *) &ap_start_cr3 - ap_start))
+    = vtop (pd);
+  *(uint32_t *) (start_code + ((char *) &ap_start_esp - ap_start))
+    = (uint32_t) idle + PGSIZE;
+
+  lapic_start_ap (c->apic_id, AP_START_BASE);
+  for (ms = 0; ms < 100 && !c->started; ms++)
+    timer_mdelay (1);
+  return c->started;
+}
+
+/* Entered on an application processor from ap-start.S, with
+   interrupts off, running on its idle thread's stack.  Finishes
+   setting up the CPU and goes on to run threads. */
+void
+cpu_ap_main (void)
+{
+  struct cpu *c = cpu_current ();
+
+  /* Leave the startup page directory, which cpu_start_aps()
+     frees. */
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
+
+  intr_init_ap ();
+#ifdef USERPROG
+  gdt_load ();
+#endif
+  lapic_init_ap ();
+
+  c->started = true;
+  thread_start_ap ();
+}
+
+/* Returns the CPU that the caller is running on.  The running
+   thread's page is found from the stack pointer, and the
+   scheduler keeps that thread's `cpu' member up to date.  Unless
+   interrupts are off, the running thread may move to another CPU
+   at any time, so that the result is only a hint. */
+struct cpu *
+cpu_current (void)
+{
+  uint32_t *esp;
+  struct thread *t;
+
+  /* Before any AP is started, possibly even before thread_init()
+     has set up the running thread, there is only the BSP. */
+  if (cpu_cnt < 2)
+    return &cpus[0];
+
+  asm ("mov %%esp, %0" : "=g" (esp));
+  t = pg_round_down (esp);
+  return t->cpu;
+}
+
+/* Returns the bootstrap processor. */
+struct cpu *
+cpu_bsp (void)
+{
+  return &cpus[0];
+}
+
+/* Returns true if every online CPU is running its idle thread. */
+bool
+cpu_all_idle (void)
+{
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (cpus[i].online && cpus[i].cur != cpus[i].idle)
+      return false;
+  return true;
+}
+
+/* Makes C, which should be idle, look for a thread to run, if it
+   has not already been asked to since it last scheduled. */
+void
+cpu_kick (struct cpu *c)
+{
+  ASSERT (c != cpu_current ());
+
+  if (!c->kicked)
+    {
+      c->kicked = true;
+      lapic_send_ipi (c->apic_id, IPI_RESCHEDULE);
+    }
+}
+
+/* Called on each iteration of a busy-wait loop that waits with
+   interrupts off for another CPU.  That CPU may hold the kernel
+   lock and be waiting in turn for this one to flush its TLB. */
+void
+cpu_relax (void)
+{
+  struct cpu *c = cpu_current ();
+
+  /* See [IA32-v2b] "PAUSE". */
+  asm volatile ("pause" : : : "memory");
+  if (c->tlb_flush)
+    flush_tlb (c);
+}
+
+/* Takes the kernel lock for the running CPU.  Interrupts must be
+   off. */
+void
+cpu_kernel_lock (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  spinlock_acquire (&kernel_lock);
+}
+
+/* Releases the kernel lock, which the running CPU must hold.
+   Interrupts must be off, and stay off. */
+void
+cpu_kernel_unlock (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  spinlock_release (&kernel_lock);
+}
+
+/* Returns true if the running CPU holds the kernel lock.
+   Interrupts must be off. */
+bool
+cpu_holds_kernel_lock (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  return spinlock_held_by_current_cpu (&kernel_lock);
+}
+
+#ifdef USERPROG
+/* Makes every other CPU that is running a process on page
+   directory PD flush its TLB, after PD has changed in a way that
+   requires it, and waits until they have.  Processes have a
+   single thread, so this can only be a CPU that is running PD's
+   process in user mode right now, or is about to enter the
+   kernel from it. */
+void
+cpu_flush_tlb (uint32_t *pd)
+{
+  struct cpu *self;
+  enum intr_level old_level;
+  int i;
+
+  old_level = intr_disable ();
+  self = cpu_current ();
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct cpu *c = &cpus[i];
+      if (c != self && c->online && c->cur->pagedir == pd)
+        {
+          c->tlb_flush = true;
+          lapic_send_ipi (c->apic_id, IPI_TLB_FLUSH);
+        }
+    }
+  for (i = 0; i < cpu_cnt; i++)
+    while (cpus[i].tlb_flush)
+      cpu_relax ();
+  intr_set_level (old_level);
+}
+#endif
+
+/* Flushes the TLB of C, the running CPU, as requested by another
+   CPU. */
+static void
+flush_tlb (struct cpu *c)
+{
+  uint32_t cr3;
+
+  /* Reloading CR3 flushes the TLB.  See [IA32-v3a] 3.12
+     "Translation Lookaside Buffers (TLBs)". */
+  asm volatile ("movl %%cr3, %0; movl %0, %%cr3" : "=r" (cr3) : : "memory");
+  c->tlb_flush = false;
+}
+
+/* Reschedule interprocessor interrupt handler.  Sent to an idle
+   CPU when another one has made a thread ready. */
+static void
+reschedule_interrupt (struct intr_frame *args UNUSED)
+{
+  intr_yield_on_return ();
+}
+
+/* TLB flush interprocessor interrupt handler.  Runs without the
+   kernel lock. */
+static void
+tlb_flush_interrupt (struct intr_frame *args UNUSED)
+{
+  struct cpu *c = cpu_current ();
+
+  if (c->tlb_flush)
+    flush_tlb (c);
+}
+
+/* Returns the BIOS's MP configuration table, or a null pointer
+   if there is none we can use. */
+static struct mp_config *
+mp_find_config (void)
+{
+  uint16_t ebda_seg = *(uint16_t *) ptov (0x40e);
+  uint16_t base_kb = *(uint16_t *) ptov (0x413);
+  struct mp_fp *fp;
+  struct mp_config *config;
+
+  /* Look in the first kB of the extended BIOS data area, or the
+     last kB of base memory, then in the BIOS ROM. */
+  fp = NULL;
+  if (ebda_seg != 0)
+    fp = mp_search ((uintptr_t) ebda_seg << 4, 1024);
+  if (fp == NULL && base_kb >= 1)
+    fp = mp_search ((uintptr_t) (base_kb - 1) * 1024, 1024);
+  if (fp == NULL)
+    fp = mp_search (0xf0000, 0x10000);
+
+  /* A default configuration, without a table, is not
+     supported. */
+  if (fp == NULL || fp->config == 0
+      || fp->config + sizeof *config > init_ram_pages * PGSIZE)
+    return NULL;
+  config = ptov (fp->config);
+  if (memcmp (config->signature, "PCMP", 4)
+      || fp->config + config->length > init_ram_pages * PGSIZE
+      || !mp_checksum_ok (config, config->length))
+    return NULL;
+  return config;
+}
+
+/* Returns the MP floating pointer structure in the SIZE bytes of
+   physical memory at PADDR, or a null pointer if there is none. */
+static struct mp_fp *
+mp_search (uintptr_t paddr, size_t size)
+{
+  uint8_t *p = ptov (paddr);
+  uint8_t *end = p + size;
+
+  for (; p + sizeof (struct mp_fp) <= end; p += 16)
+    if (!memcmp (p, "_MP_", 4) && mp_checksum_ok (p, sizeof (struct mp_fp)))
+      return (struct mp_fp *) p;
+  return NULL;
+}
+
+/* Returns true if the SIZE bytes at P sum to 0, as MP structures
+   must. */
+static bool
+mp_checksum_ok (const void *p_, size_t size)
+{
+  const uint8_t *p = p_;
+  uint8_t sum = 0;
+
+  while (size-- > 0)
+    sum += *p++;
+  return sum == 0;
+}
@@ -0,0 +1,73 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <debug.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Maximum number of CPUs. */
+#define CPU_MAX 8
+
+/* Per-CPU state.
+
+   Each CPU runs threads from its own ready list, and a CPU whose
+   list is empty steals from the others (see thread.c).  A
+   thread's `cpu' member names the CPU it last ran on, and so the
+   current CPU is found through the running thread, the same way
+   that running_thread() finds the running thread through the
+   stack pointer.
+
+   Only one CPU at a time runs kernel code, the one holding the
+   kernel lock (see cpu.c), and that lock protects everything
+   here except where noted. */
+struct cpu
+  {
+    int id;                             /* Index into cpus[]. */
+    uint8_t apic_id;                    /* Local APIC ID. */
+    volatile bool started;              /* AP has left its startup code? */
+    bool online;                        /* Scheduling threads? */
+    struct thread *cur;                 /* Thread running on this CPU. */
+    struct thread *idle;                /* This CPU's idle thread. */
+
+    /* Run queue. */
+    struct list ready_list;             /* Threads in THREAD_READY state. */
+    int ready_cnt;                      /* # of threads in ready_list. */
+    bool kicked;                        /* Sent a reschedule IPI? */
+
+    /* Owned by this CPU, and only used with interrupts off. */
+    bool in_external_intr;              /* Processing an external interrupt? */
+    bool yield_on_return;               /* Yield on interrupt return? */
+    unsigned thread_ticks;              /* # of timer ticks since last yield. */
+
+    /* Set by the CPU holding the kernel lock, cleared by this one. */
+    volatile bool tlb_flush;            /* TLB flush requested? */
+
+    /* Statistics. */
+    long long idle_ticks;               /* # of timer ticks spent idle. */
+    long long kernel_ticks;             /* # of timer ticks in kernel threads. */
+    long long user_ticks;               /* # of timer ticks in user programs. */
+  };
+
+extern struct cpu cpus[CPU_MAX];
+extern int cpu_cnt;
+extern int cpu_limit;
+
+void cpu_init (void);
+void cpu_start_aps (void);
+void cpu_ap_main (void) NO_RETURN;
+struct cpu *cpu_current (void);
+struct cpu *cpu_bsp (void);
+bool cpu_all_idle (void);
+void cpu_kick (struct cpu *);
+void cpu_relax (void);
+
+void cpu_kernel_lock (void);
+void cpu_kernel_unlock (void);
+bool cpu_holds_kernel_lock (void);
+
+#ifdef USERPROG
+void cpu_flush_tlb (uint32_t *pd);
+#endif
+
+#endif /* threads/cpu.h */
@@ -15,6 +15,7 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -22,6 +23,7 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -34,6 +36,9 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/file.h"
@@ -55,6 +60,10 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Roles and sizes of RAM disks to create. */
+static char *ramdisk_specs[BLOCK_CNT];
+static size_t ramdisk_spec_cnt;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -69,6 +78,7 @@ static void run_actions (char **argv);
 static void usage (void);
 
 #ifdef FILESYS
+static void create_ramdisks (void);
 static void locate_block_devices (void);
 static void locate_block_device (enum block_type, const char *name);
 #endif
@@ -133,13 +143,18 @@ main (void)
   thread_start ();
   serial_init_queue ();
   timer_calibrate ();
+  workqueue_init ();
+
+  /* Bring up the other CPUs, if any. */
+  cpu_start_aps ();
 
 #ifdef FILESYS
   /* Initialize file system. */
+  create_ramdisks ();
   ide_init ();
+  virtio_blk_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
-  file_fd_init();
 #endif
 
   frame_init();
@@ -265,6 +280,14 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        {
+          if (ramdisk_spec_cnt >= BLOCK_CNT)
+            PANIC ("too many -ramdisk options");
+          ramdisk_specs[ramdisk_spec_cnt++] = value;
+        }
+      else if (!strcmp (name, "-flush-age"))
+        cache_flush_age = (int64_t) atoi (value) * TIMER_FREQ / 1000;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -276,6 +299,8 @@ parse_options (char **argv)
         thread_mlfqs = true;
 	  else if (!strcmp (name, "-aging"))
 		thread_prior_aging = true;
+      else if (!strcmp (name, "-smp"))
+        cpu_limit = atoi (value);
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -393,12 +418,16 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=ROLE:KB   Create a KB kB RAM disk for ROLE (filesys,\n"
+          "                     scratch or swap), ahead of the IDE disks.\n"
+          "  -flush-age=MS      Write back file data dirty for MS ms (5000).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -smp=N             Use at most N CPUs (default and maximum 8).\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -407,6 +436,37 @@ usage (void)
 }
 
 #ifdef FILESYS
+/* Creates the RAM disks requested with -ramdisk.  They are
+   registered before the IDE disks, so they take precedence when
+   roles are assigned by probe order. */
+static void
+create_ramdisks (void)
+{
+  size_t i;
+
+  for (i = 0; i < ramdisk_spec_cnt; i++)
+    {
+      char *spec = ramdisk_specs[i];
+      char *save_ptr;
+      char *role = spec != NULL ? strtok_r (spec, ":", &save_ptr) : NULL;
+      char *size = role != NULL ? strtok_r (NULL, "", &save_ptr) : NULL;
+      enum block_type type;
+      int kb;
+
+      if (size == NULL)
+        PANIC ("-ramdisk requires ROLE:KB");
+      for (type = BLOCK_FILESYS; type < BLOCK_ROLE_CNT; type++)
+        if (!strcmp (role, block_type_name (type)))
+          break;
+      if (type >= BLOCK_ROLE_CNT)
+        PANIC ("-ramdisk: unknown role `%s'", role);
+      kb = atoi (size);
+      if (kb <= 0)
+        PANIC ("-ramdisk: bad size `%s'", size);
+      ramdisk_create (type, kb * (1024 / BLOCK_SECTOR_SIZE));
+    }
+}
+
 /* Figure out what block devices to cast in the various Pintos roles. */
 static void
 locate_block_devices (void)
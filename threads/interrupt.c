@@ -3,11 +3,13 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
 #include "devices/timer.h"
 
 /* Programmable Interrupt Controller (PIC) registers.
@@ -33,19 +35,24 @@ static intr_handler_func *intr_handlers[INTR_CNT];
 /* Names for each interrupt, for debugging purposes. */
 static const char *intr_names[INTR_CNT];
 
+/* Interrupts whose handlers run without the kernel lock. */
+static bool intr_unlocked[INTR_CNT];
+
 /* Number of unexpected interrupts for each vector.  An
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
 
 /* External interrupts are those generated by devices outside the
-   CPU, such as the timer.  External interrupts run with
-   interrupts turned off, so they never nest, nor are they ever
-   pre-empted.  Handlers for external interrupts also may not
-   sleep, although they may invoke intr_yield_on_return() to
-   request that a new process be scheduled just before the
-   interrupt returns. */
-static bool in_external_intr;   /* Are we processing an external interrupt? */
-static bool yield_on_return;    /* Should we yield on interrupt return? */
+   CPU, such as the timer, that come through the PICs
+   (0x20...0x2f), and those sent by local APICs (0xf0...0xff).
+   External interrupts run with interrupts turned off, so they
+   never nest, nor are they ever pre-empted.  Handlers for
+   external interrupts also may not sleep, although they may
+   invoke intr_yield_on_return() to request that a new process be
+   scheduled just before the interrupt returns.  Whether the
+   running CPU is processing one is kept in its struct cpu. */
+static bool is_external (uint8_t vec_no);
+static void end_of_interrupt (uint8_t vec_no);
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
@@ -113,7 +120,8 @@ intr_disable (void)
   return old_level;
 }
 
-/* Initializes the interrupt system. */
+/* Initializes the interrupt system on the bootstrap
+   processor. */
 void
 intr_init (void)
 {
@@ -157,6 +165,15 @@ intr_init (void)
   intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Loads the IDT, which intr_init() has set up, on an application
+   processor. */
+void
+intr_init_ap (void)
+{
+  uint64_t idtr_operand = make_idtr_operand (sizeof idt - 1, idt);
+  asm volatile ("lidt %0" : : "m" (idtr_operand));
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -181,10 +198,24 @@ void
 intr_register_ext (uint8_t vec_no, intr_handler_func *handler,
                    const char *name) 
 {
-  ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+  ASSERT (is_external (vec_no));
   register_handler (vec_no, 0, INTR_OFF, handler, name);
 }
 
+/* Registers interprocessor interrupt VEC_NO, which some CPU may
+   send while it holds the kernel lock and waits for the
+   receiving CPU.  Its HANDLER is therefore invoked without the
+   kernel lock, and must only do what is safe to do concurrently
+   with kernel code on the other CPU. */
+void
+intr_register_unlocked (uint8_t vec_no, intr_handler_func *handler,
+                        const char *name)
+{
+  ASSERT (vec_no >= 0xf0 && vec_no != LAPIC_SPURIOUS_VEC);
+  register_handler (vec_no, 0, INTR_OFF, handler, name);
+  intr_unlocked[vec_no] = true;
+}
+
 /* Registers internal interrupt VEC_NO to invoke HANDLER, which
    is named NAME for debugging purposes.  The interrupt handler
    will be invoked with interrupt status LEVEL.
@@ -202,7 +233,7 @@ void
 intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
                    intr_handler_func *handler, const char *name)
 {
-  ASSERT (vec_no < 0x20 || vec_no > 0x2f);
+  ASSERT (!is_external (vec_no));
   register_handler (vec_no, dpl, level, handler, name);
 }
 
@@ -211,7 +242,12 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
 bool
 intr_context (void) 
 {
-  return in_external_intr;
+  /* External interrupt handlers never turn interrupts on.  With
+     interrupts on, the running thread could also move to another
+     CPU between finding its CPU and reading the flag. */
+  if (intr_get_level () == INTR_ON)
+    return false;
+  return cpu_current ()->in_external_intr;
 }
 
 /* During processing of an external interrupt, directs the
@@ -222,7 +258,7 @@ void
 intr_yield_on_return (void) 
 {
   ASSERT (intr_context ());
-  yield_on_return = true;
+  cpu_current ()->yield_on_return = true;
 }
 
 /* 8259A Programmable Interrupt Controller. */
@@ -274,6 +310,26 @@ pic_end_of_interrupt (int irq)
     outb (0xa0, 0x20);
 }
 
+/* Returns true if VEC_NO is an external interrupt, from the
+   PICs or from a local APIC. */
+static bool
+is_external (uint8_t vec_no)
+{
+  return (vec_no >= 0x20 && vec_no < 0x30) || vec_no >= 0xf0;
+}
+
+/* Acknowledges external interrupt VEC_NO to whichever interrupt
+   controller delivered it.  A local APIC does not expect an
+   acknowledgement for a spurious interrupt. */
+static void
+end_of_interrupt (uint8_t vec_no)
+{
+  if (vec_no < 0x30)
+    pic_end_of_interrupt (vec_no);
+  else if (vec_no != LAPIC_SPURIOUS_VEC)
+    lapic_eoi ();
+}
+
 /* Creates an gate that invokes FUNCTION.
 
    The gate has descriptor privilege level DPL, meaning that it
@@ -345,27 +401,54 @@ void
 intr_handler (struct intr_frame *frame) 
 {
   bool external;
+  bool locked;
   intr_handler_func *handler;
+  enum intr_level old_level;
+  struct cpu *c;
+
+  /* Another CPU may be holding the kernel lock while it waits for
+     this interrupt to be handled. */
+  if (intr_unlocked[frame->vec_no])
+    {
+      intr_handlers[frame->vec_no] (frame);
+      lapic_eoi ();
+      return;
+    }
+
+  /* Only the CPU holding the kernel lock runs kernel code (see
+     cpu.c).  Take it, unless the code this interrupt interrupted
+     was already running under it.  The lock belongs to the CPU,
+     and the running thread must not move to another CPU between
+     checking and taking it, so interrupts are off meanwhile even
+     for a trap gate. */
+  old_level = intr_disable ();
+  locked = !cpu_holds_kernel_lock ();
+  if (locked)
+    cpu_kernel_lock ();
+  intr_set_level (old_level);
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
-     and they need to be acknowledged on the PIC (see below).
+     and they need to be acknowledged on the interrupt controller
+     (see below).
      An external interrupt handler cannot sleep. */
-  external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+  external = is_external (frame->vec_no);
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (!intr_context ());
 
-      in_external_intr = true;
-      yield_on_return = false;
+      c = cpu_current ();
+      c->in_external_intr = true;
+      c->yield_on_return = false;
     }
 
   /* Invoke the interrupt's handler. */
   handler = intr_handlers[frame->vec_no];
   if (handler != NULL)
     handler (frame);
-  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f)
+  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f
+           || frame->vec_no == LAPIC_SPURIOUS_VEC)
     {
       /* There is no handler, but this interrupt can trigger
          spuriously due to a hardware fault or hardware race
@@ -380,12 +463,23 @@ intr_handler (struct intr_frame *frame)
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (intr_context ());
 
-      in_external_intr = false;
-      pic_end_of_interrupt (frame->vec_no); 
+      c = cpu_current ();
+      c->in_external_intr = false;
+      end_of_interrupt (frame->vec_no); 
 
-      if (yield_on_return) 
+      if (c->yield_on_return) 
         thread_yield (); 
     }
+
+  /* Give up the kernel lock if the interrupted code did not hold
+     it, such as a user program.  This thread may be running on
+     another CPU by now, but that one holds the lock instead.
+     Interrupts stay off until intr_exit returns. */
+  if (locked)
+    {
+      intr_disable ();
+      cpu_kernel_unlock ();
+    }
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
@@ -29,6 +29,7 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
@@ -124,7 +125,8 @@ sema_up (struct semaphore *sema)
 	list_sort(&sema->waiters, less_priority, NULL);
     thread_unblock (list_entry (list_pop_back (&sema->waiters),
                                 struct thread, elem));
-	thread_yield();
+	if(intr_context()) intr_yield_on_return();
+	else thread_yield();
   }
   intr_set_level (old_level);
 }
@@ -261,6 +263,76 @@ int lock_priority (struct lock *lock) {
 	return thread_get_priority_of(list_entry(list_max(&lock->semaphore.waiters, less_priority, NULL), struct thread, elem));
 }
 
+/* Atomically stores NEW into *DST and returns the old value. */
+static inline uint32_t
+atomic_xchg (volatile uint32_t *dst, uint32_t new)
+{
+  /* See [IA32-v2b] "XCHG".  XCHG with a memory operand is
+     always locked, the prefix is only for readability. */
+  asm volatile ("lock; xchgl %0, %1" : "+r" (new), "+m" (*dst) : : "memory");
+  return new;
+}
+
+/* Initializes spinlock LOCK as released. */
+void
+spinlock_init (struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+
+  lock->locked = 0;
+  lock->cpu = NULL;
+}
+
+/* Acquires LOCK, spinning until it becomes available.  Turns
+   interrupts off on the current CPU until spinlock_release(), so
+   that an interrupt handler on this CPU cannot spin forever on a
+   lock its own CPU holds.  Spinlocks are not recursive.
+
+   This function never sleeps, so it may be called within an
+   interrupt handler. */
+void
+spinlock_acquire (struct spinlock *lock)
+{
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (!spinlock_held_by_current_cpu (lock));
+  while (atomic_xchg (&lock->locked, 1) != 0)
+    while (lock->locked)
+      cpu_relax ();
+  lock->old_level = old_level;
+  lock->cpu = cpu_current ();
+}
+
+/* Releases LOCK, which must be held by the current CPU, and
+   restores the interrupt level from before it was acquired. */
+void
+spinlock_release (struct spinlock *lock)
+{
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+  ASSERT (spinlock_held_by_current_cpu (lock));
+
+  old_level = lock->old_level;
+  lock->cpu = NULL;
+  atomic_xchg (&lock->locked, 0);
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current CPU holds LOCK, false otherwise.
+   Interrupts must be off, or the running thread could move to
+   another CPU before the caller looks at the result. */
+bool
+spinlock_held_by_current_cpu (const struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+
+  return lock->locked && lock->cpu == cpu_current ();
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem 
   {
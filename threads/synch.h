@@ -3,6 +3,8 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
 
 /* A counting semaphore. */
 struct semaphore 
@@ -31,6 +33,23 @@ void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 int lock_priority (struct lock *);
 
+/* Spinlock.
+   Busy-waits instead of sleeping, so unlike a lock it may be
+   taken by interrupt handlers and by the scheduler itself, and
+   it excludes other CPUs rather than other threads.  Interrupts
+   stay off on the holding CPU until it is released. */
+struct spinlock
+  {
+    volatile uint32_t locked;   /* Nonzero while held. */
+    enum intr_level old_level;  /* Interrupt level before acquire. */
+    struct cpu *cpu;            /* CPU holding the lock. */
+  };
+
+void spinlock_init (struct spinlock *);
+void spinlock_acquire (struct spinlock *);
+void spinlock_release (struct spinlock *);
+bool spinlock_held_by_current_cpu (const struct spinlock *);
+
 /* Condition variable. */
 struct condition 
   {
@@ -7,6 +7,7 @@
 #include <list.h>
 #include <skip_list.h>
 #include <fixed-point.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -16,6 +17,7 @@
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "filesys/file.h"
+#include "filesys/directory.h"
 #include "devices/timer.h"
 #include "vm/page.h"
 #ifdef USERPROG
@@ -28,10 +30,6 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
@@ -39,9 +37,6 @@ static struct list all_list;
 /* List of processes which are slept by timer. */
 static struct list sleep_list;
 
-/* Idle thread. */
-static struct thread *idle_thread;
-
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
@@ -56,16 +51,10 @@ struct kernel_thread_frame
     void *aux;                  /* Auxiliary data for function. */
   };
 
-/* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
-
-/* Scheduling. */
+/* Scheduling.  The ready lists, idle threads and per-CPU
+   statistics live in struct cpu (see cpu.h). */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 static int load_avg;			/* load average */
-static int ready_cnt;			/* # of threads in the ready list */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
@@ -78,12 +67,15 @@ bool thread_prior_aging;
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
+static void idle_loop (void) NO_RETURN;
 static struct thread *running_thread (void);
-static struct thread *next_thread_to_run (void);
+static struct thread *next_thread_to_run (struct cpu *);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
+static bool is_idle_thread (struct thread *);
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
+static void rq_push (struct thread *);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
 
@@ -92,7 +84,8 @@ static tid_t allocate_tid (void);
    general and it is possible in this case only because loader.S
    was careful to put the bottom of the stack at a page boundary.
 
-   Also initializes the run queue and the tid lock.
+   Also initializes the bootstrap CPU, which takes the kernel
+   lock for it, and the tid lock.
 
    After calling this function, be sure to initialize the page
    allocator before trying to create any threads with
@@ -105,23 +98,24 @@ thread_init (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
 
+  cpu_init ();
   lock_init (&tid_lock);
-  list_init (&ready_list);
   list_init (&all_list);
   list_init (&sleep_list);
 
   load_avg = 0;
-  ready_cnt = 0;
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
+  initial_thread->cpu = cpu_bsp ();
+  initial_thread->cpu->cur = initial_thread;
   initial_thread->tid = allocate_tid ();
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
-   Also creates the idle thread. */
+   Also creates the bootstrap CPU's idle thread. */
 void
 thread_start (void) 
 {
@@ -133,10 +127,61 @@ thread_start (void)
   /* Start preemptive thread scheduling. */
   intr_enable ();
 
-  /* Wait for the idle thread to initialize idle_thread. */
+  /* Wait for the idle thread to register itself with its CPU. */
   sema_down (&start_idle);
 }
 
+/* Creates the idle thread of application processor C, and makes
+   it C's running thread.  Unlike other threads, it is not
+   started by the scheduler: C starts out on its stack, in
+   cpu_ap_main(), and calls thread_start_ap() from there.
+   Returns a null pointer if memory is exhausted. */
+struct thread *
+thread_create_idle (struct cpu *c)
+{
+  struct thread *t;
+  char name[16];
+
+  ASSERT (c != cpu_bsp ());
+
+  t = palloc_get_page (PAL_ZERO);
+  if (t == NULL)
+    return NULL;
+
+  snprintf (name, sizeof name, "idle%d", c->id);
+  init_thread (t, name, PRI_MIN);
+  t->tid = allocate_tid ();
+  page_init (&t->spt);
+  t->status = THREAD_RUNNING;
+  t->cpu = c;
+  c->idle = c->cur = t;
+  return t;
+}
+
+/* Starts scheduling threads on the running application
+   processor, which must be running its idle thread with
+   interrupts off. */
+void
+thread_start_ap (void)
+{
+  struct cpu *c = cpu_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (thread_current () == c->idle);
+
+  cpu_kernel_lock ();
+  c->online = true;
+  idle_loop ();
+}
+
+/* Asks for the running thread to be preempted by a thread made
+   ready during a timer tick.  Idle ticks may be counted outside
+   of an interrupt, on the way into the scheduler, where there is
+   no need. */
+static void yield_after_tick(void) {
+	if(intr_context()) intr_yield_on_return();
+}
+
 /* Check sleeping threads. If there are some threads
    which sleeping ticks are elapsed, awake them */
 static void check_sleeping_threads(void) {
@@ -151,7 +196,7 @@ static void check_sleeping_threads(void) {
 			list_remove(&t->elem); // remove from sleep list
 			t->ticks = -1;
 			thread_unblock(t);
-			intr_yield_on_return();
+			yield_after_tick();
 		}
 	}
 }
@@ -174,10 +219,10 @@ static void aging_priority(void) {
 	struct thread *t;
 	for(e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)) {
 		t = list_entry(e, struct thread, allelem);
-		if(t != idle_thread && t->status != THREAD_RUNNING) t->priority++;
+		if(!is_idle_thread(t) && t->status != THREAD_RUNNING) t->priority++;
 		if(t->priority > PRI_MAX) t->priority = PRI_MAX;
 	}
-	intr_yield_on_return();
+	yield_after_tick();
 }
 
 /* Re-calculate priority every 4 ticks */
@@ -186,17 +231,21 @@ static void recalc_priority(void) {
 	struct thread *t;
 	for(e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)) {
 		t = list_entry(e, struct thread, allelem);
-		if(t != idle_thread) t->priority = ftoi(sub_f_i(sub_i_f(PRI_MAX, div_f_i(t->recent_cpu, 4)), (t->nice * 2)), 1);
+		if(!is_idle_thread(t)) t->priority = ftoi(sub_f_i(sub_i_f(PRI_MAX, div_f_i(t->recent_cpu, 4)), (t->nice * 2)), 1);
 		if(t->priority < PRI_MIN) t->priority = PRI_MIN;
 		if(t->priority > PRI_MAX) t->priority = PRI_MAX;
 	}
-	intr_yield_on_return();
+	yield_after_tick();
 }
 
 /* Update load_avg every 1 sec */
 static void update_load_avg(void) {
-	int count = ready_cnt;
-	if(thread_current() != idle_thread) count++;
+	int count = 0, i;
+	for(i = 0; i < cpu_cnt; i++) {
+		if(!cpus[i].online) continue;
+		count += cpus[i].ready_cnt;
+		if(!is_idle_thread(cpus[i].cur)) count++;
+	}
 	load_avg = sum_f_f(mul_f_f(div_i_i(59, 60), load_avg), mul_f_i(div_i_i(1, 60), count));
 }
 
@@ -208,33 +257,39 @@ static void update_recent_cpu(void) {
 	int load_avg_temp = div_f_f(mul_i_f(2, load_avg), sum_f_i(mul_i_f(2, load_avg), 1));
 	for(e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)) {
 		t = list_entry(e, struct thread, allelem);
-		if(t != idle_thread) t->recent_cpu = sum_f_i(mul_f_f(load_avg_temp, t->recent_cpu), t->nice);
+		if(!is_idle_thread(t)) t->recent_cpu = sum_f_i(mul_f_f(load_avg_temp, t->recent_cpu), t->nice);
 	}
 }
 
-/* Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
-void
-thread_tick (void) 
+/* Does the per-tick bookkeeping of CPU C for a tick during
+   which T was running on it. */
+static void
+account_tick (struct cpu *c, struct thread *t)
 {
-  struct thread *t = thread_current ();
-
   /* Update statistics. */
-  if (t == idle_thread)
-    idle_ticks++;
+  if (t == c->idle)
+    c->idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
-    user_ticks++;
+    c->user_ticks++;
 #endif
   else
-    kernel_ticks++;
+    c->kernel_ticks++;
+
+  /* BSD scheduler */
+  if(thread_mlfqs && t != c->idle) t->recent_cpu = sum_f_i(t->recent_cpu, 1);
+}
 
+/* Does the bookkeeping that is due once per tick of
+   timer_ticks(), whichever CPUs were busy. */
+static void
+global_tick (void)
+{
   /* Aging priority */
   if(thread_prior_aging && timer_ticks() % 50 == 0) aging_priority();
 
   /* BSD scheduler */
   if(thread_mlfqs) {
-	if(t != idle_thread) t->recent_cpu = sum_f_i(t->recent_cpu, 1);
   	if(timer_ticks() % TIMER_FREQ == 0) {
 		update_load_avg();
   		update_recent_cpu();
@@ -244,16 +299,56 @@ thread_tick (void)
 
   /* Wake up time expired sleeping threads */
   check_sleeping_threads();
+}
+
+/* Called by the timer interrupt handler at each timer tick, on
+   every CPU: by the PIT's on the bootstrap processor, which also
+   counts timer_ticks(), and by the local APIC timer's on the
+   others.  Thus, this function runs in an external interrupt
+   context. */
+void
+thread_tick (void) 
+{
+  struct cpu *c = cpu_current ();
+
+  account_tick (c, thread_current ());
+  if (c == cpu_bsp ())
+    global_tick ();
 
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (++c->thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
-/* Prints thread statistics. */
+/* Called by the timer interrupt handler for a tick that passed
+   while every CPU was idle with the bootstrap processor's
+   periodic timer stopped.  Does the same bookkeeping as
+   thread_tick(), but charges the tick to the bootstrap
+   processor's idle thread rather than to whichever thread is
+   running now, and does not count it toward that thread's time
+   slice. */
+void
+thread_idle_tick (void)
+{
+  struct cpu *bsp = cpu_bsp ();
+
+  account_tick (bsp, bsp->idle);
+  global_tick ();
+}
+
+/* Prints thread statistics, summed over all CPUs. */
 void
 thread_print_stats (void) 
 {
+  long long idle_ticks = 0, kernel_ticks = 0, user_ticks = 0;
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      idle_ticks += cpus[i].idle_ticks;
+      kernel_ticks += cpus[i].kernel_ticks;
+      user_ticks += cpus[i].user_ticks;
+    }
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
 }
@@ -296,9 +391,9 @@ thread_create (const char *name, int priority,
   tid = t->tid = allocate_tid ();
 
   /* Insert created thread into parent's wait list */
-  if(t != initial_thread && t != idle_thread && function != idle) {
+  if(t != initial_thread && function != idle) {
       t->parent = running_thread();
-	  if(t->parent == idle_thread) t->parent = initial_thread;
+	  if(is_idle_thread(t->parent)) t->parent = initial_thread;
       if(t->parent->wait_list == NULL) {
           t->parent->wait_list = malloc(sizeof(struct skip_list));
           skip_list_init(t->parent->wait_list);
@@ -317,6 +412,12 @@ thread_create (const char *name, int priority,
 
   page_init(&t->spt);
 
+#ifdef FILESYS
+  /* Inherit working directory */
+  if(t->parent != NULL && t->parent->cwd != NULL)
+	  t->cwd = dir_reopen(t->parent->cwd);
+#endif
+
   if(t->parent == NULL) {
 	  t->nice = NICE_DEFAULT;
 	  t->recent_cpu = 0;
@@ -375,6 +476,10 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
+   T is queued on the running CPU, which is usually the one that
+   produced whatever T was waiting for; an idle CPU steals it
+   from there if this one is busy (see rq_push()).
+
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
@@ -387,9 +492,8 @@ thread_unblock (struct thread *t)
   ASSERT (is_thread (t));
   ASSERT (t->status == THREAD_BLOCKED);
 
-  list_push_front(&ready_list, &t->elem);
-  ready_cnt++;
   t->status = THREAD_READY;
+  rq_push (t);
   intr_set_level (old_level);
 }
 
@@ -467,11 +571,9 @@ thread_exit (void)
   page_destroy(&cur->spt);
 
 #ifdef FILESYS
-  if(cur->fd_list != NULL) {
-      file_remove_all_fd(cur);
-      skip_list_destroy(cur->fd_list);
-      free(cur->fd_list);
-  }
+  file_remove_all_fd(cur);
+  dir_close(cur->cwd);
+  cur->cwd = NULL;
 #endif
 
 #ifdef USERPROG
@@ -485,7 +587,7 @@ thread_exit (void)
   list_remove (&cur->allelem);
 
   /* tell parent thread that this thread is going to exit */
-  if(cur != initial_thread && cur != idle_thread && cur->wait_elem->wait_flag){
+  if(cur != initial_thread && !is_idle_thread(cur) && cur->wait_elem->wait_flag){
 	  if(cur->wait_elem->orphan_flag) thread_remove_wait_elem(cur->parent, cur->wait_elem);
 	  else thread_unblock(cur->parent); // unblock parent thread to finish wait
   }
@@ -506,11 +608,9 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) {
-	  list_push_front(&ready_list, &cur->elem);
-	  ready_cnt++;
-  }
   cur->status = THREAD_READY;
+  if (!is_idle_thread (cur))
+    rq_push (cur);
   schedule ();
   intr_set_level (old_level);
 }
@@ -541,7 +641,7 @@ thread_set_priority (int new_priority)
 
 /* Sets the specific thread's priority to NEW_PRIORITY. */
 void thread_set_priority_of(struct thread *t, int new_priority) {
-	if(t == NULL || t == idle_thread) return;
+	if(t == NULL || is_idle_thread(t)) return;
 	if(new_priority > PRI_MAX) new_priority = PRI_MAX;
 	if(new_priority < PRI_MIN) new_priority = PRI_MIN;
 	t->priority = new_priority;
@@ -592,26 +692,45 @@ thread_get_recent_cpu (void)
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
-   The idle thread is initially put on the ready list by
-   thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   The bootstrap processor's idle thread is initially put on the
+   ready list by thread_start().  It will be scheduled once
+   initially, at which point it becomes its CPU's `idle' thread,
+   "up"s the semaphore passed to it to enable thread_start() to
+   continue, and immediately blocks.  After that, the idle thread
+   never appears in a ready list.  It is returned by
+   next_thread_to_run() as a special case when there is nothing
+   to run or steal.  Application processors start out on their
+   idle threads instead (see thread_create_idle()). */
 static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  struct thread *cur = thread_current ();
+
+  cur->cpu->idle = cur;
   sema_up (idle_started);
+  idle_loop ();
+}
 
+/* The idle thread's loop, entered with the kernel lock held. */
+static void
+idle_loop (void)
+{
   for (;;) 
     {
       /* Let someone else run. */
       intr_disable ();
       thread_block ();
 
+      /* Nothing to run: stop the periodic timer interrupt until
+         the next sleeper is due, if that is far enough away. */
+      timer_idle_enter ();
+
+      /* Let other CPUs into the kernel while this one halts.  The
+         interrupt that wakes it takes the lock back for its
+         handler (see intr_handler()). */
+      cpu_kernel_unlock ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -625,6 +744,12 @@ idle (void *idle_started_ UNUSED)
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
          7.11.1 "HLT Instruction". */
       asm volatile ("sti; hlt" : : : "memory");
+
+      /* Some interrupt woke us up.  If it made a thread ready,
+         schedule() restarts the periodic timer on the way out of
+         the idle thread; otherwise the countdown keeps going. */
+      intr_disable ();
+      cpu_kernel_lock ();
     }
 }
 
@@ -660,6 +785,13 @@ is_thread (struct thread *t)
   return t != NULL && t->magic == THREAD_MAGIC;
 }
 
+/* Returns true if T is the idle thread of the CPU it runs on. */
+static bool
+is_idle_thread (struct thread *t)
+{
+  return t->cpu != NULL && t == t->cpu->idle;
+}
+
 /* Does basic initialization of T as a blocked thread named
    NAME. */
 static void
@@ -693,21 +825,90 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-/* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+/* Adds T to the running CPU's ready list.  If this CPU is busy,
+   wakes up an idle one to steal T.  The kernel lock protects
+   every CPU's ready list. */
+static void
+rq_push (struct thread *t)
+{
+  struct cpu *c = cpu_current ();
+  int i;
+
+  list_push_front (&c->ready_list, &t->elem);
+  c->ready_cnt++;
+
+  /* A thread that yields or an idle CPU about to schedule will
+     pick T up from here. */
+  if (t == c->cur || is_idle_thread (c->cur))
+    return;
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct cpu *other = &cpus[i];
+      if (other != c && other->online && other->cur == other->idle)
+        {
+          cpu_kick (other);
+          break;
+        }
+    }
+}
+
+/* Removes and returns the highest-priority thread in C's ready
+   list, or a null pointer if the list is empty. */
 static struct thread *
-next_thread_to_run (void) 
+rq_pop (struct cpu *c)
 {
-  if (list_empty (&ready_list))
-    return idle_thread;
-  else {
-	list_sort(&ready_list, less_priority, NULL);
-	ready_cnt--;
-    return list_entry (list_pop_back (&ready_list), struct thread, elem);
-  }
+  if (list_empty (&c->ready_list))
+    return NULL;
+  list_sort (&c->ready_list, less_priority, NULL);
+  c->ready_cnt--;
+  return list_entry (list_pop_back (&c->ready_list), struct thread, elem);
+}
+
+/* Steals a thread for CPU C, whose own ready list is empty, from
+   the online CPU with the most ready threads.  Returns a null
+   pointer if there is nothing to steal. */
+static struct thread *
+rq_steal (struct cpu *c)
+{
+  struct cpu *victim = NULL;
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct cpu *v = &cpus[i];
+      if (v != c && v->online && v->ready_cnt > 0
+          && (victim == NULL || v->ready_cnt > victim->ready_cnt))
+        victim = v;
+    }
+  return victim != NULL ? rq_pop (victim) : NULL;
+}
+
+/* Returns true if C has a thread to run or steal. */
+static bool
+rq_has_work (struct cpu *c)
+{
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    if ((&cpus[i] == c || cpus[i].online) && cpus[i].ready_cnt > 0)
+      return true;
+  return false;
+}
+
+/* Chooses and returns the next thread to be scheduled on CPU C.
+   Should return a thread from C's run queue, unless the run
+   queue is empty.  (If the running thread can continue running,
+   then it will be in the run queue.)  If the run queue is empty,
+   steals a thread from another CPU, and failing that returns C's
+   idle thread. */
+static struct thread *
+next_thread_to_run (struct cpu *c) 
+{
+  struct thread *t = rq_pop (c);
+
+  if (t == NULL)
+    t = rq_steal (c);
+  return t != NULL ? t : c->idle;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -735,9 +936,10 @@ thread_schedule_tail (struct thread *prev)
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  cur->cpu->cur = cur;
 
   /* Start new time slice. */
-  thread_ticks = 0;
+  cur->cpu->thread_ticks = 0;
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -767,13 +969,27 @@ static void
 schedule (void) 
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
+  struct cpu *c = cur->cpu;
+  struct thread *next;
   struct thread *prev = NULL;
 
+  /* Leaving the idle thread, maybe straight from the interrupt
+     that ended its halt: every other thread needs the periodic
+     timer tick.  Catching up with the idle ticks may wake more
+     sleepers, so do it before choosing the next thread.  The
+     bootstrap processor's timer only stops while every CPU is
+     idle, so this works from any of them. */
+  if (cur == c->idle && rq_has_work (c))
+    timer_idle_exit ();
+  c->kicked = false;
+  next = next_thread_to_run (c);
+
   ASSERT (intr_get_level () == INTR_OFF); // interrupts must be off
   ASSERT (cur->status != THREAD_RUNNING); // cur->status should be changed from THREAD_RUNNING before call this function. So, cur->status must not THREAD_RUNNING.
   ASSERT (is_thread (next)); // next should be a thread
 
+  /* NEXT runs on this CPU from now on, wherever it was queued. */
+  next->cpu = c;
   if (cur != next)
     prev = switch_threads (cur, next);
   thread_schedule_tail (prev);
@@ -818,7 +1034,7 @@ void thread_remove_wait_elem(struct thread *t, struct wait_elem *e) {
 void thread_sleep(int64_t ticks) {
 	enum intr_level old_level = intr_disable();
 	struct thread *cur = thread_current();
-	if(cur == idle_thread) return;
+	if(is_idle_thread(cur)) return;
 	//printf("thread %s(%d) sleep until %d\n", cur->name, cur->tid, ticks);
 	cur->ticks = ticks;
 	list_push_back(&sleep_list, &cur->elem);
@@ -826,6 +1042,20 @@ void thread_sleep(int64_t ticks) {
 	intr_set_level(old_level);
 }
 
+/* Returns the earliest tick at which a sleeping thread is due to
+   be woken up, or INT64_MAX if no thread is sleeping.
+   Interrupts must be off. */
+int64_t thread_next_wakeup(void) {
+	struct list_elem *e;
+	int64_t next = INT64_MAX;
+	ASSERT(intr_get_level() == INTR_OFF);
+	for(e = list_begin(&sleep_list); e != list_end(&sleep_list); e = list_next(e)) {
+		struct thread *t = list_entry(e, struct thread, elem);
+		if(t->ticks < next) next = t->ticks;
+	}
+	return next;
+}
+
 /* Awake thread which is sleeping by force.
    This function doesn't check is thread sleeping or not.
    So should be guaranteed that the thread is sleeping, before call this function. */
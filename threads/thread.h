@@ -99,6 +99,7 @@ struct thread
     uint8_t *stack;                     /* Saved stack pointer. */
     int priority;                       /* Priority. */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct cpu *cpu;                    /* CPU it runs or last ran on. */
 
 	/* BSD Scheduler */
 	int nice;
@@ -122,7 +123,10 @@ struct thread
 
     /* For file system */
 #ifdef FILESYS
-	struct skip_list *fd_list;           /* Skip list of file descriptors */
+	struct fd_table *fds;                /* File descriptor table, or NULL */
+	struct dir *cwd;                     /* Working directory, NULL for root */
+	int journal_depth;                   /* Nesting of journal transactions */
+	int journal_logged;                  /* Sectors its transaction logged */
 #endif
 
 	/* For prevent modifying excutable file */
@@ -167,8 +171,11 @@ extern bool thread_mlfqs;
 
 void thread_init (void);
 void thread_start (void);
+struct thread *thread_create_idle (struct cpu *);
+void thread_start_ap (void) NO_RETURN;
 
 void thread_tick (void);
+void thread_idle_tick (void);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -206,5 +213,6 @@ void thread_remove_wait_elem(struct thread *, struct wait_elem *);
 /* For timer sleep */
 void thread_sleep(int64_t);
 void thread_awake(struct thread *);
+int64_t thread_next_wakeup(void);
 
 #endif /* threads/thread.h */
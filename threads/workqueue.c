@@ -0,0 +1,328 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of worker threads. */
+#define WORKER_CNT 3
+
+/* All workqueues, highest priority first.
+   Protected by disabling interrupts, like everything below,
+   because work may be scheduled by interrupt handlers. */
+static struct list queues;
+
+/* Counts the work items pending on all queues.  Idle workers
+   wait on it, so every successful "down" entitles a worker to
+   exactly one item. */
+static struct semaphore work_avail;
+
+/* Work items scheduled with a delay, soonest due first.  The
+   timer looks at it from the start, even before
+   workqueue_init(). */
+static struct list delayed = LIST_INITIALIZER (delayed);
+
+struct workqueue system_wq;
+
+/* A thread waiting in workqueue_flush(). */
+struct flusher
+  {
+    struct list_elem elem;      /* Element in the queue's flushers. */
+    struct semaphore done;      /* Upped when the queue drains. */
+  };
+
+static thread_func worker;
+static bool queue_higher_priority (const struct list_elem *,
+                                   const struct list_elem *, void *);
+static void wake_flushers (struct workqueue *);
+static void enqueue (struct workqueue *, struct work *);
+
+/* Initializes the workqueue subsystem and starts the worker
+   threads.  The scheduler must have been started. */
+void
+workqueue_init (void)
+{
+  int i;
+
+  list_init (&queues);
+  sema_init (&work_avail, 0);
+  workqueue_create (&system_wq, "system", PRI_DEFAULT);
+
+  for (i = 0; i < WORKER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "worker %d", i);
+      thread_create (name, PRI_DEFAULT, worker, NULL);
+    }
+}
+
+/* Initializes WQ as a queue named NAME whose work runs at
+   PRIORITY, and makes it visible to the workers. */
+void
+workqueue_create (struct workqueue *wq, const char *name, int priority)
+{
+  enum intr_level old_level;
+
+  ASSERT (wq != NULL);
+  ASSERT (priority >= PRI_MIN && priority <= PRI_MAX);
+
+  wq->name = name;
+  wq->priority = priority;
+  list_init (&wq->pending);
+  wq->running = 0;
+  list_init (&wq->flushers);
+
+  old_level = intr_disable ();
+  list_insert_ordered (&queues, &wq->elem, queue_higher_priority, NULL);
+  intr_set_level (old_level);
+}
+
+/* Waits until every item queued on WQ before the call, and any
+   that they queue in turn, has finished running. */
+void
+workqueue_flush (struct workqueue *wq)
+{
+  enum intr_level old_level;
+  struct flusher f;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (!list_empty (&wq->pending) || wq->running > 0)
+    {
+      sema_init (&f.done, 0);
+      list_push_back (&wq->flushers, &f.elem);
+      sema_down (&f.done);
+    }
+  intr_set_level (old_level);
+}
+
+/* Initializes W as a work item that runs FUNC(AUX). */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->wq = NULL;
+  w->delayed = false;
+  w->func = func;
+  w->aux = aux;
+}
+
+/* Queues W on WQ, to be run once by a worker thread.  Returns
+   true if W was queued, false if it was already pending, in which
+   case the pending run will do.  A running item may reschedule
+   itself.  May be called from an interrupt handler. */
+bool
+work_schedule (struct workqueue *wq, struct work *w)
+{
+  enum intr_level old_level;
+  bool queued = false;
+
+  old_level = intr_disable ();
+  if (w->wq == NULL)
+    {
+      enqueue (wq, w);
+      queued = true;
+    }
+  intr_set_level (old_level);
+
+  return queued;
+}
+
+/* Returns true if delayed work item A is due before B. */
+static bool
+due_earlier (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct work *a = list_entry (a_, struct work, elem);
+  const struct work *b = list_entry (b_, struct work, elem);
+
+  return a->due < b->due;
+}
+
+/* Queues W on WQ like work_schedule(), but only after TICKS timer
+   ticks have passed.  Returns true if W was scheduled, false if
+   it was already pending or waiting to be.  May be called from an
+   interrupt handler. */
+bool
+work_schedule_delayed (struct workqueue *wq, struct work *w, int64_t ticks)
+{
+  enum intr_level old_level;
+  bool queued = false;
+
+  if (ticks <= 0)
+    return work_schedule (wq, w);
+
+  old_level = intr_disable ();
+  if (w->wq == NULL)
+    {
+      w->wq = wq;
+      w->delayed = true;
+      w->due = timer_ticks () + ticks;
+      list_insert_ordered (&delayed, &w->elem, due_earlier, NULL);
+      queued = true;
+    }
+  intr_set_level (old_level);
+
+  return queued;
+}
+
+/* Called by the timer interrupt handler at tick NOW.  Queues the
+   delayed work items that have come due. */
+void
+workqueue_tick (int64_t now)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (!list_empty (&delayed))
+    {
+      struct work *w = list_entry (list_front (&delayed), struct work, elem);
+      if (w->due > now)
+        break;
+      list_pop_front (&delayed);
+      w->delayed = false;
+      enqueue (w->wq, w);
+    }
+}
+
+/* Returns the tick at which the next delayed work item comes due,
+   or INT64_MAX if there is none.  Interrupts must be off. */
+int64_t
+workqueue_next_due (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (list_empty (&delayed))
+    return INT64_MAX;
+  return list_entry (list_front (&delayed), struct work, elem)->due;
+}
+
+/* Removes W from its queue if it has not started running yet.
+   Returns true if it was removed.  A work item that is already
+   running is not waited for. */
+bool
+work_cancel (struct work *w)
+{
+  enum intr_level old_level;
+  bool cancelled = false;
+
+  old_level = intr_disable ();
+  if (w->delayed)
+    {
+      list_remove (&w->elem);
+      w->delayed = false;
+      w->wq = NULL;
+      cancelled = true;
+    }
+  else if (w->wq != NULL)
+    {
+      struct workqueue *wq = w->wq;
+      list_remove (&w->elem);
+      w->wq = NULL;
+      if (list_empty (&wq->pending) && wq->running == 0)
+        wake_flushers (wq);
+
+      /* Take back the count that W added.  If a worker has
+         already taken it, that worker finds one item too few and
+         simply goes back to waiting. */
+      sema_try_down (&work_avail);
+      cancelled = true;
+    }
+  intr_set_level (old_level);
+
+  return cancelled;
+}
+
+/* Worker thread.  Runs pending work items forever, the oldest
+   item of the highest-priority queue first. */
+static void
+worker (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct workqueue *wq = NULL;
+      struct list_elem *e;
+      struct work *w;
+      work_func *func;
+      void *func_aux;
+
+      sema_down (&work_avail);
+
+      old_level = intr_disable ();
+      for (e = list_begin (&queues); e != list_end (&queues);
+           e = list_next (e))
+        {
+          wq = list_entry (e, struct workqueue, elem);
+          if (!list_empty (&wq->pending))
+            break;
+        }
+      if (e == list_end (&queues))
+        {
+          /* The item was cancelled. */
+          intr_set_level (old_level);
+          continue;
+        }
+
+      w = list_entry (list_pop_front (&wq->pending), struct work, elem);
+      w->wq = NULL;
+      func = w->func;
+      func_aux = w->aux;
+      wq->running++;
+      intr_set_level (old_level);
+
+      /* W may be freed or queued again by FUNC, so only the
+         copies taken above are used from here on. */
+      if (thread_get_priority () != wq->priority)
+        thread_set_priority (wq->priority);
+      func (func_aux);
+
+      old_level = intr_disable ();
+      wq->running--;
+      if (list_empty (&wq->pending) && wq->running == 0)
+        wake_flushers (wq);
+      intr_set_level (old_level);
+    }
+}
+
+/* Returns true if queue A has a higher priority than queue B. */
+static bool
+queue_higher_priority (const struct list_elem *a_,
+                       const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct workqueue *a = list_entry (a_, struct workqueue, elem);
+  const struct workqueue *b = list_entry (b_, struct workqueue, elem);
+
+  return a->priority > b->priority;
+}
+
+/* Puts W at the end of WQ's pending list and lets a worker know.
+   Interrupts must be off. */
+static void
+enqueue (struct workqueue *wq, struct work *w)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  w->wq = wq;
+  list_push_back (&wq->pending, &w->elem);
+  sema_up (&work_avail);
+}
+
+/* Wakes up every thread waiting for WQ to drain.
+   Interrupts must be off. */
+static void
+wake_flushers (struct workqueue *wq)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (!list_empty (&wq->flushers))
+    {
+      struct flusher *f = list_entry (list_pop_front (&wq->flushers),
+                                      struct flusher, elem);
+      sema_up (&f->done);
+    }
+}
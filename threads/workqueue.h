@@ -0,0 +1,68 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Deferred work.
+
+   A small, fixed pool of worker kernel threads runs work items
+   on behalf of the rest of the kernel, so that background
+   activities do not each need a thread of their own.  Work is
+   queued on a workqueue, and every workqueue has a priority:
+   idle workers always take the oldest item of the
+   highest-priority queue that has any, and run it at that
+   queue's priority.
+
+   work_schedule() may be called from an interrupt handler, which
+   is how a handler defers the part of its job that may sleep
+   (its "bottom half") to thread context.  work_schedule_delayed()
+   queues an item only once a number of timer ticks has passed,
+   for periodic jobs that would otherwise each need a thread that
+   sleeps in a loop. */
+
+/* Function run by a work item, given auxiliary data AUX. */
+typedef void work_func (void *aux);
+
+/* A work item. */
+struct work
+  {
+    struct list_elem elem;      /* Element in its queue's pending list,
+                                   or in the delayed list. */
+    struct workqueue *wq;       /* Queue it is pending on, or NULL. */
+    bool delayed;               /* Waiting in the delayed list? */
+    int64_t due;                /* Timer tick to queue it at, if so. */
+    work_func *func;            /* Function to run. */
+    void *aux;                  /* Argument to FUNC. */
+  };
+
+/* A queue of work items. */
+struct workqueue
+  {
+    const char *name;           /* Name (for debugging purposes). */
+    int priority;               /* Priority its work runs at. */
+    struct list_elem elem;      /* Element in the list of queues. */
+    struct list pending;        /* Work items not yet started. */
+    int running;                /* Number of items being run. */
+    struct list flushers;       /* Threads in workqueue_flush(). */
+  };
+
+/* Queue for work that has no reason to be anywhere else. */
+extern struct workqueue system_wq;
+
+void workqueue_init (void);
+void workqueue_create (struct workqueue *, const char *name, int priority);
+void workqueue_flush (struct workqueue *);
+
+void work_init (struct work *, work_func *, void *aux);
+bool work_schedule (struct workqueue *, struct work *);
+bool work_schedule_delayed (struct workqueue *, struct work *,
+                            int64_t ticks);
+bool work_cancel (struct work *);
+
+/* For the timer. */
+void workqueue_tick (int64_t now);
+int64_t workqueue_next_due (void);
+
+#endif /* threads/workqueue.h */
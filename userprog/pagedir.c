@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/thread.h"
 #include "threads/init.h"
 #include "threads/pte.h"
@@ -251,7 +252,8 @@ active_pd (void)
    re-activating it.
 
    This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
+   directory, and has any other CPU that is running PD's process
+   do the same.  (If PD is not active then its entries are not in
    the TLB, so there is no need to invalidate anything.) */
 static void
 invalidate_pagedir (uint32_t *pd) 
@@ -262,4 +264,5 @@ invalidate_pagedir (uint32_t *pd)
          "Translation Lookaside Buffers (TLBs)". */
       pagedir_activate (pd);
     } 
+  cpu_flush_tlb (pd);
 }
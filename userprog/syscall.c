@@ -7,12 +7,21 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
+#include "devices/block.h"
 #include "devices/shutdown.h"
 #include "devices/input.h"
+#include "devices/timer.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "filesys/inode.h"
+#include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 static void syscall_handler (struct intr_frame *);
+static bool direct_ok(struct file *, const void *, unsigned);
+static int direct_io(struct file *, uint8_t *, unsigned, bool write);
 
 void
 syscall_init (void) 
@@ -78,6 +87,26 @@ syscall_handler (struct intr_frame *f UNUSED)
 		  if(f->esp > PHYS_BASE - 2 * sizeof(uintptr_t)) exit(-1);
 		  close(*(int*)(f->esp+sizeof(uintptr_t)));
 		  break;
+	  case SYS_CHDIR:
+		  if(f->esp > PHYS_BASE - 2 * sizeof(uintptr_t)) exit(-1);
+		  f->eax = chdir(*(char**)(f->esp+sizeof(uintptr_t)));
+		  break;
+	  case SYS_MKDIR:
+		  if(f->esp > PHYS_BASE - 2 * sizeof(uintptr_t)) exit(-1);
+		  f->eax = mkdir(*(char**)(f->esp+sizeof(uintptr_t)));
+		  break;
+	  case SYS_READDIR:
+		  if(f->esp + 12 > PHYS_BASE - 3 * sizeof(uintptr_t)) exit(-1);
+		  f->eax = readdir(*(int*)(f->esp+12+sizeof(uintptr_t)), *(char**)(f->esp+12+2*sizeof(uintptr_t)));
+		  break;
+	  case SYS_ISDIR:
+		  if(f->esp > PHYS_BASE - 2 * sizeof(uintptr_t)) exit(-1);
+		  f->eax = isdir(*(int*)(f->esp+sizeof(uintptr_t)));
+		  break;
+	  case SYS_INUMBER:
+		  if(f->esp > PHYS_BASE - 2 * sizeof(uintptr_t)) exit(-1);
+		  f->eax = inumber(*(int*)(f->esp+sizeof(uintptr_t)));
+		  break;
 	  case SYS_FIBONACCI:
 		  if(f->esp > PHYS_BASE - 2 * sizeof(uintptr_t)) exit(-1);
 		  f->eax = fibonacci(*(int*)(f->esp+sizeof(uintptr_t)));
@@ -86,6 +115,21 @@ syscall_handler (struct intr_frame *f UNUSED)
 		  if(f->esp + 20 > PHYS_BASE - 5 * sizeof(uintptr_t)) exit(-1);
 		  f->eax = sum4int(*(int*)(f->esp+20+sizeof(uintptr_t)), *(int*)(f->esp+20+2*sizeof(uintptr_t)), *(int*)(f->esp+20+3*sizeof(uintptr_t)), *(int*)(f->esp+20+4*sizeof(uintptr_t)));
 		  break;
+	  case SYS_MONOTONIC_NS:
+		  if(f->esp > PHYS_BASE - 2 * sizeof(uintptr_t)) exit(-1);
+		  monotonic_ns(*(int64_t**)(f->esp+sizeof(uintptr_t)));
+		  break;
+	  case SYS_BLOCKSTATS:
+		  if(f->esp + 12 > PHYS_BASE - 3 * sizeof(uintptr_t)) exit(-1);
+		  f->eax = blockstats(*(unsigned*)(f->esp+12+sizeof(uintptr_t)), *(struct block_stats**)(f->esp+12+2*sizeof(uintptr_t)));
+		  break;
+	  case SYS_FSYNC:
+		  if(f->esp > PHYS_BASE - 2 * sizeof(uintptr_t)) exit(-1);
+		  f->eax = fsync(*(int*)(f->esp+sizeof(uintptr_t)));
+		  break;
+	  case SYS_SYNC:
+		  sync();
+		  break;
 	  default: break;
   }
 }
@@ -137,7 +181,9 @@ int open(const char *file) {
 	if(file == NULL) exit(-1);
 	struct file* res = filesys_open(file);
 	if(res == NULL) return -1;
-	return file_new_fd(res, thread_current());
+	int fd = file_new_fd(res, thread_current());
+	if(fd == -1) file_close(res);
+	return fd;
 }
 
 int filesize(int fd) {
@@ -160,6 +206,8 @@ int read(int fd, void *buffer, unsigned size) {
 	} else {
 		struct file *file = file_of_fd(fd, thread_current());
 		if(file == NULL) exit(-1);
+		if(inode_is_dir(file_get_inode(file))) return -1;
+		if(direct_ok(file, buffer, size)) return direct_io(file, buffer, size, false);
 		return file_read(file, buffer, size);
 	}
 }
@@ -173,10 +221,74 @@ int write(int fd, void *buffer, unsigned size) {
 	} else {
 		struct file *file = file_of_fd(fd, thread_current());
 		if(file == NULL) exit(-1);
+		if(inode_is_dir(file_get_inode(file))) return -1;
+		if(direct_ok(file, buffer, size)) return direct_io(file, buffer, size, true);
 		return file_write(file, buffer, size);
 	}
 }
 
+/* Zero-copy I/O: a read or write whose user buffer and file position
+   are both sector-aligned, and which covers at least one whole sector,
+   hands the file system the kernel address of each user page in turn.
+   The file system then moves whole sectors between the disk and the
+   page's frame directly, instead of copying them through the buffer
+   cache.  The frame is pinned meanwhile, so it cannot be evicted. */
+static bool direct_ok(struct file *file, const void *buffer, unsigned size) {
+	return size >= BLOCK_SECTOR_SIZE && (uintptr_t)buffer % BLOCK_SECTOR_SIZE == 0
+	       && file_tell(file) % BLOCK_SECTOR_SIZE == 0;
+}
+
+/* Returns the kernel address of the frame holding user page UPAGE,
+   pinned until unpin_user_page(), or NULL if it is not in memory */
+static void *pin_user_page(void *upage) {
+#ifdef VM
+	return frame_pin(upage);
+#else
+	return pagedir_get_page(thread_current()->pagedir, upage);
+#endif
+}
+
+static void unpin_user_page(void *kpage UNUSED) {
+#ifdef VM
+	frame_unpin(kpage);
+#endif
+}
+
+/* Times direct_io() tries to pin a page before it gives up and copies
+   that page's part of the transfer through the buffer cache. */
+#define DIRECT_PIN_TRIES 3
+
+/* Reads or writes SIZE bytes of FILE at user BUFFER one page at a time,
+   through the pinned frame of each page. */
+static int direct_io(struct file *file, uint8_t *buffer, unsigned size, bool write) {
+	unsigned done = 0;
+	while(done < size) {
+		uint8_t *uaddr = buffer + done;
+		unsigned chunk = PGSIZE - pg_ofs(uaddr);
+		uint8_t *kpage = NULL;
+		int byte, tries;
+		off_t n;
+
+		if(chunk > size - done) chunk = size - done;
+		for(tries = 0; kpage == NULL && tries < DIRECT_PIN_TRIES; tries++) {
+			/* Fault the page in, making sure it is writable if reading into it */
+			if(uaddr >= (uint8_t*)PHYS_BASE || (byte = get_user(uaddr)) == -1
+			   || (!write && !put_user(uaddr, byte))) exit(-1);
+			/* NULL if it was evicted again already */
+			kpage = pin_user_page(pg_round_down(uaddr));
+		}
+		if(kpage != NULL) {
+			n = write ? file_write_direct(file, kpage + pg_ofs(uaddr), chunk)
+			          : file_read_direct(file, kpage + pg_ofs(uaddr), chunk);
+			unpin_user_page(kpage);
+		}
+		else n = write ? file_write(file, uaddr, chunk) : file_read(file, uaddr, chunk);
+		done += n;
+		if(n < (off_t)chunk) break;
+	}
+	return done;
+}
+
 void seek(int fd, unsigned position) {
 	struct file *file = file_of_fd(fd, thread_current());
 	if(file == NULL) exit(-1);
@@ -196,6 +308,35 @@ void close(int fd) {
 	file_remove_fd(fd, thread_current());
 }
 
+bool chdir(const char *dir) {
+	if(dir == NULL || (void*)dir >= PHYS_BASE) exit(-1);
+	return filesys_chdir(dir);
+}
+
+bool mkdir(const char *dir) {
+	if(dir == NULL || (void*)dir >= PHYS_BASE) exit(-1);
+	return filesys_mkdir(dir);
+}
+
+bool readdir(int fd, char *name) {
+	if(name == NULL || (void*)name >= PHYS_BASE) exit(-1);
+	struct file *file = file_of_fd(fd, thread_current());
+	if(file == NULL) exit(-1);
+	return file_readdir(file, name);
+}
+
+bool isdir(int fd) {
+	struct file *file = file_of_fd(fd, thread_current());
+	if(file == NULL) exit(-1);
+	return inode_is_dir(file_get_inode(file));
+}
+
+int inumber(int fd) {
+	struct file *file = file_of_fd(fd, thread_current());
+	if(file == NULL) exit(-1);
+	return (int)inode_get_inumber(file_get_inode(file));
+}
+
 int fibonacci(int n) {
 	int a = 1, b = 1, temp, i;
 	for(i = 3; i <= n; i++) {
@@ -209,3 +350,34 @@ int fibonacci(int n) {
 int sum4int(int a, int b, int c, int d) {
 	return a + b + c + d;
 }
+
+void monotonic_ns(int64_t *ns) {
+	if(ns == NULL || (void*)ns > PHYS_BASE - sizeof *ns
+	   || !put_user((uint8_t*)ns, 0) || !put_user((uint8_t*)(ns + 1) - 1, 0)) exit(-1);
+	*ns = timer_ns();
+}
+
+bool blockstats(unsigned idx, struct block_stats *stats) {
+	struct block_stats kstats;
+	struct block *block;
+
+	if(stats == NULL || (void*)stats > PHYS_BASE - sizeof *stats
+	   || !put_user((uint8_t*)stats, 0) || !put_user((uint8_t*)(stats + 1) - 1, 0)) exit(-1);
+	for(block = block_first(); block != NULL && idx > 0; idx--)
+		block = block_next(block);
+	if(block == NULL) return false;
+	block_get_stats(block, &kstats);
+	memcpy(stats, &kstats, sizeof *stats);
+	return true;
+}
+
+bool fsync(int fd) {
+	struct file *file = file_of_fd(fd, thread_current());
+	if(file == NULL) exit(-1);
+	inode_sync(file_get_inode(file));
+	return true;
+}
+
+void sync(void) {
+	filesys_sync();
+}
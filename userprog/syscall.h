@@ -2,6 +2,8 @@
 #define USERPROG_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <block-stats.h>
 
 typedef int pid_t;
 
@@ -20,7 +22,16 @@ int write(int, void*, unsigned);
 void seek(int, unsigned);
 unsigned tell(int);
 void close(int);
+bool chdir(const char *);
+bool mkdir(const char *);
+bool readdir(int, char *);
+bool isdir(int);
+int inumber(int);
 int fibonacci(int);
 int sum4int(int, int, int, int);
+void monotonic_ns(int64_t *);
+bool blockstats(unsigned, struct block_stats *);
+bool fsync(int);
+void sync(void);
 
 #endif /* userprog/syscall.h */
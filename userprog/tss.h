@@ -5,7 +5,7 @@
 
 struct tss;
 void tss_init (void);
-struct tss *tss_get_ (void);
+struct tss *tss_get_ (int cpu);
 void tss_update (void);
 
 #endif /* userprog/tss.h */
@@ -22,6 +22,7 @@ struct frame_elem {
 	void *spt;
 	void *upage;
 	void *kpage;
+	bool pinned; // Must not be evicted while the kernel uses it
 };
 struct lock frame_lock;
 struct frame_elem *victim;
@@ -84,12 +85,15 @@ static void* get_victim_frame(void) {
     struct list_elem *le = &victim->elem;
     void* kpage;
     size_t i;
-    for(i = 0; i < list_size(&frame_list); i++, le = list_next(le)) {
+    // Two rounds, so that an unpinned frame is found even if all were accessed
+    for(i = 0; i < 2 * list_size(&frame_list); i++, le = list_next(le)) {
         if(le == list_end(&frame_list)) le = list_begin(&frame_list);
         e = list_entry(le, struct frame_elem, elem);
+        if(e->pinned) continue;
         if(!pagedir_is_accessed(e->pd, e->upage)) break;
 		pagedir_set_accessed(e->pd, e->upage, false);
     }
+    if(e->pinned) return NULL;
     if(list_next(le) == list_end(&frame_list)) victim = list_entry(list_begin(&frame_list), struct frame_elem, elem);
     else victim = list_entry(list_next(le), struct frame_elem, elem);
     kpage = e->kpage;
@@ -105,7 +109,10 @@ void* frame_alloc(void *upage, enum palloc_flags flags, bool writable) {
     void *kpage = palloc_get_page(flags);
     if(kpage == NULL) {
         kpage = get_victim_frame();
-        if(kpage == NULL) return NULL;
+        if(kpage == NULL) {
+            lock_release(&frame_lock);
+            return NULL;
+        }
     }
     uint32_t frame_num = palloc_user_page_number(kpage);
     struct frame_elem *e = get_frame(frame_num, true);
@@ -123,6 +130,7 @@ void* frame_alloc(void *upage, enum palloc_flags flags, bool writable) {
     e->spt = &(thread_current()->spt);
     e->upage = upage;
     e->kpage = kpage;
+    e->pinned = false;
     page_valid(e->spt, upage, false, e->frame_num);
     lock_release(&frame_lock);
     return kpage;
@@ -138,3 +146,24 @@ void frame_free(uint32_t frame_num) {
     free_frame(frame);
     lock_release(&frame_lock);
 }
+
+/* Pins the frame that holds user page UPAGE of the current thread, so that
+   it is not evicted until frame_unpin(), and returns its kernel address.
+   Returns NULL if UPAGE is not in memory. */
+void* frame_pin(void *upage) {
+    lock_acquire(&frame_lock);
+    void *kpage = pagedir_get_page(thread_current()->pagedir, upage);
+    struct frame_elem *e = NULL;
+    if(kpage != NULL) e = get_frame(palloc_user_page_number(kpage), false);
+    if(e != NULL) e->pinned = true;
+    lock_release(&frame_lock);
+    return e != NULL ? kpage : NULL;
+}
+
+/* Lets the frame at kernel address KPAGE, pinned by frame_pin(), be evicted again. */
+void frame_unpin(void *kpage) {
+    lock_acquire(&frame_lock);
+    struct frame_elem *e = get_frame(palloc_user_page_number(kpage), false);
+    if(e != NULL) e->pinned = false;
+    lock_release(&frame_lock);
+}
@@ -3,9 +3,12 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include "threads/palloc.h"
 
 void frame_init(void);
 void* frame_alloc(void *upage, enum palloc_flags flags, bool writable);
 void frame_free(uint32_t frame_num);
+void* frame_pin(void *upage);
+void frame_unpin(void *kpage);
 
 #endif
@@ -28,9 +28,9 @@ size_t swap_out(void *page) {
 	lock_acquire(&swap_lock);
 	size_t swap_num = bitmap_scan_and_flip(swap_map, 0, SECTORS_PER_PAGE, false);
 	if(swap_num == BITMAP_ERROR) return BITMAP_ERROR;
-	int i;
-	for(i = 0; i < SECTORS_PER_PAGE; i++)
-		block_write(swap_device, swap_num + i, page + BLOCK_SECTOR_SIZE * i);
+	struct block_segment seg = { page, SECTORS_PER_PAGE };
+	struct block_request req = { swap_num, &seg, 1 };
+	block_write_multi(swap_device, &req);
 	lock_release(&swap_lock);
 	return swap_num;
 }
@@ -39,9 +39,10 @@ size_t swap_out(void *page) {
 bool swap_in(size_t swap_num, void *page) {
 	lock_acquire(&swap_lock);
 	if(!bitmap_all(swap_map, swap_num, SECTORS_PER_PAGE)) return false;
-	int i;
+	struct block_segment seg = { page, SECTORS_PER_PAGE };
+	struct block_request req = { swap_num, &seg, 1 };
 	//printf("(swap_in) swap_num : %d / kpage : %p\n", swap_num, page);
-	for(i = 0; i < SECTORS_PER_PAGE; i++) block_read(swap_device, swap_num + i, page + BLOCK_SECTOR_SIZE * i);
+	block_read_multi(swap_device, &req);
 	bitmap_set_multiple(swap_map, swap_num, SECTORS_PER_PAGE, false);
 	lock_release(&swap_lock);
 	return true;